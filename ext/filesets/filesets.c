@@ -1,86 +1,68 @@
 /*
- *
+ * filesets: the command line front end to libfilesets (libfilesets.c).
  */
-#include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/stat.h>
-#include <sys/mman.h>
-#include <fcntl.h>
-#include <unistd.h>
 #include <limits.h>
-#ifdef __linux
-#include <linux/limits.h>
-#endif
- 
-#define FALSE 0
-#define TRUE  (!FALSE)
-
-#define MAX_OP_STACK  1024
-#define MAX_EXP_LEN  10240
- 
-/* 
- * U = Union
- * X = Intersection
- * D = Difference
- * I = Inverse/Complement
- */
-#define is_operator(c)  (c == 'U' || c == 'X' || c == 'D' || c == 'I')
-
+#include <ctype.h>
 
-typedef           int boolean;
-typedef           int int32;
-typedef unsigned  int uint32;
-typedef          long int64;
-typedef unsigned long uint64;
-
-
-typedef enum _TokenType
-{ 
-  OPERATOR = 1,
-  SFILE    = 2,
-  SET      = 3
-} TokenType;
-
-typedef struct _Token {
-  TokenType type;
-  union {
-    uint64 operator;
-    char   file[PATH_MAX];
-    char   history[MAX_EXP_LEN];
-  } x;
-  char * vector;
-} Token;
-
-typedef Token Set;
-
-typedef struct _Stack {
-  int32  depth;
-  void * data[MAX_OP_STACK];
-} Stack;
+#include "filesets.h"
 
+#define FALSE 0
+#define TRUE  (!FALSE)
 
-boolean Verbose   =  0;
-uint32  MaxSetVal = -1;
+typedef int boolean;
 
 /* -------------------------------------------------------------------- */
 
 void
 usage (void)
 {
-  fprintf(stderr, "\nUsage: file_sets -max id [-h] [-v] [-s] [-o outfile] expression \n");
+  fprintf(stderr, "\nUsage: file_sets -max id [-h] [-v] [-s|-r] [-o outfile] expression \n");
+  fprintf(stderr, "       file_sets -max id [-h] [-v] [-s|-r] [-o outfile] -f exprfile \n");
+  fprintf(stderr, "       file_sets -max id [-h] [-v] [-s|-r] [-o outfile] -U|-X listfile \n");
+  fprintf(stderr, "       file_sets -max id [-h] [-v] [-o outfile] -overlap [-json] [-jaccard] file ... \n");
   fprintf(stderr, "\n");
   fprintf(stderr, "  -h                 help\n");
   fprintf(stderr, "  -v                 verbose\n");
   fprintf(stderr, "  -s                 shuffle (randomize) order of id's in output\n");
   fprintf(stderr, "  -o outfile         write output to outfile (otherwise stdout)\n");
+  fprintf(stderr, "  -r                 write runs of consecutive id's as ranges: first-last\n");
+  fprintf(stderr, "  -f exprfile        read the expression from exprfile\n");
+  fprintf(stderr, "  -U listfile        union of every file named in listfile\n");
+  fprintf(stderr, "  -X listfile        intersection of every file named in listfile\n");
+  fprintf(stderr, "  -t threads         sweep set vectors with this many threads (default 1)\n");
+  fprintf(stderr, "  -nohuge            don't back set vectors with huge pages\n");
+  fprintf(stderr, "  -i statefile       incremental: only parse what was appended to the input files\n");
+  fprintf(stderr, "                     since the run that wrote statefile\n");
+  fprintf(stderr, "  -delta             with -i, write only the changes: +id for added and -id for removed\n");
+  fprintf(stderr, "  -b                 write the result as a binary set file, with a rank index\n");
+  fprintf(stderr, "  -offset n          skip the first n id's of the output\n");
+  fprintf(stderr, "  -limit n           write at most n id's\n");
+  fprintf(stderr, "  -idrange a:b       only write id's from a to b\n");
+  fprintf(stderr, "  -rank id           write the number of id's in the result less than id\n");
+  fprintf(stderr, "  -n k               write a uniform random sample of k id's (ascending, or\n");
+  fprintf(stderr, "                     shuffled with -s)\n");
+  fprintf(stderr, "  -strata n          with -n, split the id's into n equal ranges and sample each\n");
+  fprintf(stderr, "                     in proportion to its size\n");
+  fprintf(stderr, "  -seed n            seed the random order of -s and -n, for repeatable output\n");
+  fprintf(stderr, "  -mem bytes         keep set vectors and buffers within bytes (K, M or G suffix\n");
+  fprintf(stderr, "                     allowed), evaluating ranges of id's in passes if need be\n");
+  fprintf(stderr, "  -overlap           write the size of the intersection of every pair of files\n");
+  fprintf(stderr, "                     as a CSV matrix (the files may also be listed with -f)\n");
+  fprintf(stderr, "  -json              with -overlap, write JSON rather than CSV\n");
+  fprintf(stderr, "  -jaccard           with -overlap, write Jaccard similarities as well (JSON) or\n");
+  fprintf(stderr, "                     instead (CSV)\n");
   fprintf(stderr, "\n");
   fprintf(stderr, "expression ::= ( expression )\n");
   fprintf(stderr, "             | I expession \n");
   fprintf(stderr, "             | expression binaryOp expession \n");
+  fprintf(stderr, "             | T count ( operand ... ) \n");
   fprintf(stderr, "             | file \n");
   fprintf(stderr, "binaryOp   ::= U | X | D \n");
+  fprintf(stderr, "operand    ::= ( expression ) | file \n");
+  fprintf(stderr, "count      ::= <integer from 1 to 255>\n");
   fprintf(stderr, "file       ::= <path to file>\n");
   fprintf(stderr, "\n");
   fprintf(stderr, "Expression examples: \n");
@@ -91,9 +73,11 @@ usage (void)
   fprintf(stderr, "  f1 D ( f2 X f3 )\n");
   fprintf(stderr, "  I ( ( f1 X f2 X f3 ) U ( f4 x f5 ) \n");
   fprintf(stderr, "  ( ( f1 X f2 X f3 ) U ( f4 x f5 ) D ( ( f6 x f7 ) U ( f8 X f9 ) )\n");
+  fprintf(stderr, "  T 3 ( f1 f2 f3 f4 ( f5 D f6 ) )\n");
   fprintf(stderr, "\n");
   fprintf(stderr, "Notes:\n");
-  fprintf(stderr, "1) files must contain only positive integers separated by newlines\n");
+  fprintf(stderr, "1) files must contain only positive integers separated by newlines;\n");
+  fprintf(stderr, "   a line first-last (e.g. 1000-2500) stands for every id in that range\n");
   fprintf(stderr, "2) all files, operators and parentheses must be separate by whitespace\n");
   fprintf(stderr, "3) operators must be upper case\n");
   fprintf(stderr, "4) operator definition\n");
@@ -101,799 +85,419 @@ usage (void)
   fprintf(stderr, "  X = intersection\n");
   fprintf(stderr, "  D = difference\n");
   fprintf(stderr, "  I = inversion/complement (highest precedence)\n");
+  fprintf(stderr, "  T = threshold: the id's in at least count of the operands\n");
+  fprintf(stderr, "5) file names in exprfile and listfile may be separated by any whitespace\n");
+  fprintf(stderr, "6) with -i, input files must only ever be appended to; a file that shrinks\n");
+  fprintf(stderr, "   or is replaced, or a new expression or max ID, forces a full recompute\n");
+  fprintf(stderr, "7) any file may be a binary set file written with -b; when the expression is\n");
+  fprintf(stderr, "   just one such file, -offset, -limit, -idrange, -rank and -n read only its\n");
+  fprintf(stderr, "   index and the id's they need\n");
+  fprintf(stderr, "8) -mem partitions the input files into temporary files under $TMPDIR (or\n");
+  fprintf(stderr, "   /tmp) when it needs passes; it only works with plain and -r output\n");
   fprintf(stderr, "\n");
   fprintf(stderr, "\n");
 
   exit(-1);
 }
 
-void
-seedRandom (void)
-{
-  FILE * fp;
-  uint32 sdata[1024];
-  int    i, n;
-
-  fp = fopen ("/dev/urandom", "r");
-  if ( ! fp) 
-    return;
-
-  n = fread (sdata, sizeof(uint32), 1024, fp);
-  for (i = 0; i < n; i++) 
-    srandom (sdata[i]);
-}
-
-Token *
-tokenNew (void)
-{
-  Token * t;
-  t = malloc (sizeof(Token));
-  if (t == NULL)
-  {
-    fprintf (stderr, "tokenNew(): can't malloc() %ld bytes\n", sizeof(Token));
-    exit(-1);
-  }
-  memset(t, 0, sizeof(Token));
-  return (t);
-}
-
-void
-tokenFree (Token * t)
+/*
+ * Append str and a separating space to the malloc()'ed string buf,
+ * whose current length is *len.
+ */
+char *
+strAppend (char * buf, size_t * len, const char * str)
 {
-  free(t);
-}
+  size_t n;
 
-Set *
-setNew()
-{
-  Set * s;
-  s = (Set *) tokenNew();
-  s->vector = malloc (MaxSetVal + 1);
-  if (s->vector == NULL)
+  n = strlen(str);
+  buf = realloc (buf, *len + n + 2);
+  if (buf == NULL)
   {
-    fprintf (stderr, "setNew(): can't malloc() %u bytes\n", MaxSetVal);
+    fprintf (stderr, "filesets: ERROR: strAppend() can't realloc() %lu bytes\n", *len + n + 2);
     exit(-1);
   }
-  memset(s->vector, 0, MaxSetVal + 1);
-  s->type = SET;
-  return (s);
-}
+  memcpy (buf + *len, str, n);
+  *len += n;
+  buf[(*len)++] = ' ';
+  buf[*len] = '\0';
 
-void
-setFree (Set * s)
-{
-  free(s->vector);
-  tokenFree((Token *) s);
+  return (buf);
 }
 
-boolean
-setRead(Set * s)
+/*
+ * Read a whole file into a NUL terminated malloc()'ed buffer.
+ */
+char *
+fileSlurp (const char * file)
 {
-  int         fd;
-  struct stat statBuf;
-  char      * srcBase, * srcCurr, * srcEnd, * dstPtr;
-  char        line[1024];
-  unsigned long  id;
-
-  /*  if (Verbose) fprintf (stderr, "     loading: %s\n", s->x.file); */
+  FILE * fp;
+  char * buf;
+  size_t len = 0, n;
 
-  if (s->vector == NULL)
+  if ((fp = fopen (file, "r")) == NULL)
   {
-    s->vector = malloc (MaxSetVal + 1);
-    if (s->vector == NULL)
-    {
-      fprintf (stderr, "setNew(): can't malloc() %u bytes\n", MaxSetVal);
-      exit(-1);
-    }
-    memset(s->vector, 0, MaxSetVal + 1);
+    fprintf (stderr, "\nfilesets: ERROR: can't open %s for reading \n\n", file);
+    exit(-1);
   }
 
-  /* open the input file */
-  if ((fd = open (s->x.file, O_RDONLY)) < 0)
+  buf = malloc (BUFSIZ + 1);
+  while (buf != NULL && (n = fread (buf + len, 1, BUFSIZ, fp)) > 0)
   {
-    fprintf (stderr, "\nfilesets: ERROR: can't open %s for reading \n\n", s->x.file);
-    exit(-1);
+    len += n;
+    buf = realloc (buf, len + BUFSIZ + 1);
   }
-
-  /* find size of input file */
-  if (fstat (fd, &statBuf) < 0)
+  if (buf == NULL)
   {
-    fprintf (stderr, "fstat error: %s \n", s->x.file);
+    fprintf (stderr, "fileSlurp(): can't malloc() for %s\n", file);
     exit(-1);
   }
+  buf[len] = '\0';
+  fclose(fp);
 
-  /* mmap() fails if the file is empty (zero bytes),
-   * so check if the file is empty before mmap()'ing it.
-   * If the file is empty, then a empty set is returned.
-   */
-  if (statBuf.st_size > 0) 
-  {
-    /* mmap the input file */
-    srcBase = mmap (0, statBuf.st_size, PROT_READ,  MAP_SHARED, fd, 0);
-    if (srcBase == (char *) -1)
-      fprintf (stderr, "filesets: ERROR: mmap error for input file: %s \n", s->x.file);
-
-    srcCurr = srcBase;
-    srcEnd  = srcBase + statBuf.st_size;
-
-    dstPtr = line;
-
-    /* 
-     * The following block of commented code is equivalent to the
-     * uncommented code just after. The difference is that the 
-     * code above mmap()'ed the file and it can now be treated
-     * as one big memory block. The mmap()'ed code is faster
-     * because the file data is minimally copied and no
-     * buffering is performed, which would be wasted. However, 
-     * the faster code is doing a bunch of pointer manipulation 
-     * which may appear to be rather confusing.
-     * 
-     * while (fgets (line, 1024, fp)) {
-     *  id = strtol (line, NULL, 10);
-     *  table[id] = 1;
-     * }
-     *
-     */
-    while (srcCurr < srcEnd)
-    {
-      if (*srcCurr == '\n')
-      {
-        *dstPtr = '\0';
-        id = strtol(line, NULL, 10);
-
-        if (id > MaxSetVal)
-        {
-          fprintf (stderr, "\nfile-sets: ERROR: input data contains value greater than specified max ID\n\n");
-          exit(-1);
-        }
-
-        if (id != LONG_MIN && id != LONG_MAX && id != 0)
-          s->vector[id] = 1;
-        dstPtr = line;
-        srcCurr++;
-      }
-      *dstPtr++ = *srcCurr++;
-    }
-
-    /* Just in case the last line did not contain a newline */
-    if (dstPtr != line)
-    {
-      *dstPtr = '\0';
-      id = strtol(line, NULL, 10);
-
-      if (id > MaxSetVal)
-      {
-        fprintf (stderr, "\nfile-sets: ERROR: input data contains value greater than specified max ID\n\n");
-        exit(-1);
-      }
-
-      if (id != LONG_MIN && id != LONG_MAX && id != 0)
-        s->vector[id] = 1;
-    }
-
-    munmap(srcBase, statBuf.st_size);
-  }
-  close(fd);
-
-  s->type = SET;
-
-  return TRUE;
+  return (buf);
 }
 
-void
-setWrite(Set * s, FILE * fp)
+/*
+ * Turn a file holding a list of file names into the expression
+ * "f1 op f2 op ... fn".
+ */
+char *
+listToExpression (const char * file, char op)
 {
-  uint32 i;
+  char * list, * tok, * expr = NULL;
+  char   opStr[2] = { op, '\0' };
+  size_t len = 0;
 
-  if (Verbose) printf ("Output:\n");
-
-  if (fp == NULL) fp = stdout;
+  list = fileSlurp (file);
+  for (tok = strtok (list, " \t\r\n"); tok != NULL; tok = strtok (NULL, " \t\r\n"))
+  {
+    if (expr != NULL)
+      expr = strAppend (expr, &len, opStr);
+    expr = strAppend (expr, &len, tok);
+  }
+  free(list);
 
-  for (i = 1; i <= MaxSetVal; i++)
-    if (s->vector[i])
-      fprintf (fp, "%u\n", i);
+  if (expr == NULL)
+  {
+    fprintf (stderr, "\nfilesets: ERROR: no files listed in %s\n", file);
+    exit(-1);
+  }
 
-  fclose(fp);
+  return (expr);
 }
 
-
-Set * 
-setUnion (Set * s1, Set * s2)
+char *
+cmdLine (int argc, char *argv[])
 {
-  uint32 i;
-  char   buf[MAX_EXP_LEN];
-
-  if (s1->type == SFILE)
-    setRead(s1);
-  if (s2->type == SFILE)
-    setRead(s2);
-
-  assert(s1->type == SET && s2->type == SET);
-
-  for (i = 1; i <= MaxSetVal; i++)
-    if (s2->vector[i])
-      s1->vector[i] = s2->vector[i];
-
-  sprintf (buf, "( %s U %s )", s1->x.history, s2->x.history);
-  strcpy (s1->x.history, buf);
-  setFree (s2);
+  int i;
+  char * buf = NULL;
+  size_t len = 0;
 
-  if (Verbose)
-    fprintf (stderr, "%s\n", s1->x.history);
+  for (i = 0; i < argc; i++)
+    buf = strAppend (buf, &len, argv[i]);
 
-  return (s1);
+  return (buf);
 }
 
-
-Set * 
-setDiff (Set * s1, Set * s2)
+/*
+ * Parse a non-negative integer option value, or exit.
+ */
+unsigned long
+optionValue (const char * opt, const char * value)
 {
-  uint32 i;
-  char   buf[MAX_EXP_LEN];
+  char        * end;
+  unsigned long n;
 
-  if (s1->type == SFILE)
-    setRead(s1);
-  if (s2->type == SFILE)
-    setRead(s2);
-
-  assert(s1->type == SET && s2->type == SET);
-
-  for (i = 1; i <= MaxSetVal; i++)
-    if (s2->vector[i])
-      s1->vector[i] = 0;
-
-  sprintf (buf, "( %s D %s )", s1->x.history, s2->x.history);
-  strcpy (s1->x.history, buf);
-  setFree(s2);
-
-  if (Verbose)
-    fprintf (stderr, "%s\n", s1->x.history);
+  if (value == NULL || ! isdigit(value[0]) || (n = strtoul(value, &end, 10), *end != '\0'))
+  {
+    fprintf (stderr, "\nfilesets: ERROR: %s requires a non-negative integer.\n", opt);
+    usage();
+  }
 
-  return (s1);
+  return (n);
 }
 
-Set * 
-setIntersect (Set * s1, Set * s2)
+/*
+ * Parse a byte count option value, with an optional K, M or G suffix
+ * (powers of 1024), or exit.
+ */
+uint64_t
+byteValue (const char * opt, const char * value)
 {
-  uint32 i;
-  char   buf[MAX_EXP_LEN];
-
-  if (s1->type == SFILE)
-    setRead(s1);
-  if (s2->type == SFILE)
-    setRead(s2);
-
-  assert(s1->type == SET && s2->type == SET);
-
-  for (i = 1; i <= MaxSetVal; i++)
-    if (s1->vector[i] && s2->vector[i])
-      s1->vector[i] = 1;
-    else
-      s1->vector[i] = 0;
-
-  sprintf (buf, "( %s X %s )", s1->x.history, s2->x.history);
-  strcpy (s1->x.history, buf);
+  char        * end;
+  uint64_t      n;
 
-  setFree (s2);
-
-  if (Verbose)
-    fprintf (stderr, "%s\n", s1->x.history);
+  n = (value != NULL && isdigit(value[0])) ? strtoull(value, &end, 10) : 0;
+  if (n > 0)
+    switch (toupper(*end))
+    {
+      case 'G': n <<= 10;   /* fall through */
+      case 'M': n <<= 10;   /* fall through */
+      case 'K': n <<= 10; end++;
+    }
+  if (n == 0 || *end != '\0')
+  {
+    fprintf (stderr, "\nfilesets: ERROR: %s requires a positive number of bytes.\n", opt);
+    usage();
+  }
 
-  return (s1);
+  return (n);
 }
 
-Set * 
-setInvert (Set * s)
+/*
+ * The expression's file, if it is nothing but one binary set file,
+ * which page and rank queries can then answer from its index alone.
+ */
+char *
+binaryOperand (char * input)
 {
-  uint32 i;
-  char   buf[MAX_EXP_LEN];
-
-  if (s->type == SFILE)
-    setRead(s);
-
-  assert(s->type == SET);
-
-  for (i = 1; i <= MaxSetVal; i++)
-    if (s->vector[i])
-      s->vector[i] = 0;
-    else
-      s->vector[i] = 1;
+  size_t len = strlen(input);
 
-  sprintf (buf, "( I %s )", s->x.history);
-  strcpy (s->x.history, buf);
+  while (len > 0 && isspace(input[len - 1]))
+    input[--len] = '\0';
 
-  if (Verbose) fprintf (stderr, "%s\n", s->x.history);
+  if (len == 0 || strpbrk (input, " \t\r\n") != NULL || ! fsFileIsBinary (input))
+    return (NULL);
 
-  return (s);
+  return (input);
 }
 
+/* Write str as a CSV field, quoted if it needs to be */
 void
-setShuffleAndWrite (Set * s, FILE * fp)
+csvField (FsWriter * w, const char * str)
 {
-  uint32   i, j, idCnt, tmp;
-  char     buf[MAX_EXP_LEN];
-  uint32 * array;
+  char c[3] = "";
 
-  if (s->type == SFILE)
-    setRead(s);
-
-  assert(s->type == SET);
-
-  /* Count the number of ID in the set */
-  for (i = 1, idCnt = 0; i <= MaxSetVal; i++)
-    if (s->vector[i])
-      idCnt++;
-
-  if (idCnt == 0)
-    return;
-
-  array = malloc (sizeof(uint32) * idCnt);
-  if (array == NULL)
+  if (strpbrk (str, ",\"\r\n") == NULL)
   {
-    fprintf (stderr, "setShuffleAbdWrite(): can't malloc() %lu bytes\n", sizeof(uint32) * idCnt);
-    exit (-1);
+    fsWriterText (w, str);
+    return;
   }
 
-  /* Map the set vector to an array */
-  for (i = 1, j = 0; i <= MaxSetVal; i++)
-    if (s->vector[i])
-      array[j++] = i;
-
-  seedRandom();
-
-  /*
-   * http://en.wikipedia.org/wiki/Fisher–Yates_shuffle
-   *
-   * To shuffle an array a of n elements (indices 0..n-1):
-   * for i from n − 1 downto 1 do
-   *    j ← random integer with 0 ≤ j ≤ i
-   *    exchange a[j] and a[i]
-   */
-  for (i = (idCnt - 1); i > 0; i--)
+  fsWriterText (w, "\"");
+  for (; *str; str++)
   {
-    j = (uint32) (( ((double) random()) / ((double) RAND_MAX)) * (double) i);
-
-    /* exchange values */
-    tmp = array[j];
-    array[j] = array[i];
-    array[i] = tmp;
+    c[0] = *str;
+    c[1] = (*str == '"') ? '"' : '\0';
+    fsWriterText (w, c);
   }
-
-  sprintf (buf, "( R %s )", s->x.history);
-  strcpy (s->x.history, buf);
-
-  if (Verbose) fprintf (stderr, "%s\n", s->x.history);
-
-  for (i = 0; i < idCnt; i++)
-    fprintf (fp, "%u\n", array[i]);
+  fsWriterText (w, "\"");
 }
 
-/* -------------------------------------------------------------------- */
-
-Stack *
-stackNew (void)
+void
+jsonString (FsWriter * w, const char * str)
 {
-  Stack * s;
+  char c[8];
 
-  s = malloc (sizeof(Stack));
-  if (s == NULL)
+  fsWriterText (w, "\"");
+  for (; *str; str++)
   {
-    fprintf (stderr, "filesets: ERROR: stackNew() can't malloc() %lu bytes\n", sizeof(Stack));
-    exit(-1);
+    if (*str == '"' || *str == '\\')
+      snprintf (c, sizeof(c), "\\%c", *str);
+    else if ((unsigned char) *str < 0x20)
+      snprintf (c, sizeof(c), "\\u%04x", *str);
+    else
+      snprintf (c, sizeof(c), "%c", *str);
+    fsWriterText (w, c);
   }
-  memset(s, 0, sizeof(Stack));
-  s->depth = -1;
-  
-  return (s);
-}
-
-boolean
-stackEmpty (Stack * s)
-{
-  return (s->depth == -1);
-}
-
-Stack *
-stackPush(Stack * s, void * data)
-{
-  if (s->depth == MAX_OP_STACK)
-    return (FALSE);
-
-  s->depth++;
-  s->data[s->depth] = data;
-  return s;
-}
-
-Stack *
-stackPushOp (Stack * s, uint64 c)
-{
-  Token * t;
-  
-  t = tokenNew();
-  t->type = OPERATOR;
-  t->x.operator = c;
-
-  return stackPush(s, t);
-}
-
-Stack * 
-stackPushFile (Stack * s, char * filePath)
-{
-  Token * t;
-  
-  t = tokenNew();
-  t->type = SFILE;
-  strcpy(t->x.file, filePath);
-
-  return stackPush(s, t);
-}
-
-
-void *
-stackPop (Stack * s)
-{
-  void * data;
-
-  if (stackEmpty(s))
-    return (0);
-
-  data = s->data[s->depth];
-  s->depth--;
-
-  return (data);
-}
-
-void *
-stackPeek (Stack * s)
-{
-  void * data;
-
-  if (stackEmpty(s))
-    return (0);
-
-  data = s->data[s->depth];
-
-  return (data);
-}
-
-int32
-stackDepth (Stack * s)
-{
-  return (s->depth + 1);
+  fsWriterText (w, "\"");
 }
 
-/*
- * pop an item from the beginning of the stack
- * bug: if depth == MAX_OP_STACK then memory is copied from past the end.
- */
-void *
-stackShift (Stack * s)
+/* |A X B| / |A U B|, or 0 if both are empty */
+double
+jaccard (const uint64_t * counts, int n, int i, int j)
 {
-  void * data;
-
-  if (stackEmpty(s))
-    return (0);
-
-  data = s->data[0];
-  memmove (&(s->data[0]), &(s->data[1]), sizeof(void*) * s->depth + 1);
-  s->depth--;
+  uint64_t u = counts[i * n + i] + counts[j * n + j] - counts[i * n + j];
 
-  return (data);
+  return (u == 0 ? 0.0 : (double) counts[i * n + j] / u);
 }
 
+/* Write the Jaccard similarity of files i and j, to 6 places */
 void
-stackDump (Stack * s)
+jaccardWrite (FsWriter * w, const uint64_t * counts, int n, int i, int j)
 {
-  int i;
+  char buf[32];
 
-  fprintf (stderr, "stackDump(): depth= %d\n", s->depth);
-  for (i = s->depth; i >= 0; i--)
-    fprintf (stderr, "\t %d:  %c  %p\n", i, (unsigned char) (uint64) s->data[i],  s->data[i]);
+  snprintf (buf, sizeof(buf), "%.6f", jaccard (counts, n, i, j));
+  fsWriterText (w, buf);
 }
 
-
-/* 
- * operators (higher = greater)
- * precedence   operators       associativity
- * 2            I               left to right
- * 1            U X D           left to right
- */
-int 
-op_preced (const char c)
-{
-  switch (c)    
-  {
-    case 'I':
-      return 2;
-    case 'U':  case 'X': case 'D':
-      return 1;
-    default:
-      fprintf (stderr, "op_preced(): bad value: %c\n", c);
-      exit (-1);
-  }
-  return 0;
-}
- 
-boolean 
-op_left_assoc (const char c)
-{
-  switch(c)
-  {
-    /* left to right */
-    case 'U': case 'X': case 'D': case 'I':
-      return TRUE;
 /*
-    case 'I':                                  // right to left
-      return FALSE;
+ * Write the overlap matrix of the n files: as CSV, a header row of the
+ * file names and a row per file of its intersection sizes (or Jaccard
+ * similarities); as JSON, the files, their sizes, the intersection
+ * sizes and optionally the Jaccard similarities.
  */
-    default:
-      fprintf (stderr, "op_left_assoc(): bad value: %c\n", c);
-      exit (-1);
-  }
-  return FALSE;
-}
- 
-unsigned int 
-op_arg_count (const char c)
+void
+overlapWrite (FsWriter * w, char ** files, int n, const uint64_t * counts, boolean json, boolean jac)
 {
-  switch(c)
-  {
-    case 'U': case 'X': case 'D': 
-      return 2;
-    case 'I':
-      return 1;
-    default:
-      fprintf (stderr, "op_arg_count(): bad value: %c\n", c);
-      exit (-1);
-  }
-  return 0;
-}
- 
+  int i, j;
 
-boolean 
-convertToPostfix (const char *input, Stack * outputStack)
-{
-  boolean pe = FALSE;
-  Stack * opStack;
-  uint64  c;
-  uint64  sc;
-  char  * tok;
-  char  * buffer;
-
-  /* Since strtok() mangles the input, make a copy before calling. */
-  buffer = malloc (strlen (input) + 1);
-  if (buffer == NULL)
-  {
-    fprintf (stderr, "convertToPostfix(): Can't malloc() for buffer\n");
-    exit(-1);
-  }
-  strcpy(buffer, input);
-
-  opStack = stackNew();
-
-  tok = strtok(buffer, " "); /* Pull the first token */
-  while (tok != NULL)
+  if ( ! json)
   {
-    /* printf ("tok= %s \n", tok); */
-    /* stackDump (opStack); */
-
-    c = tok[0];
-
-    /* If the token is an operator (U, X, D, I), then: */
-    if (strlen(tok) == 1 && is_operator(c))
-    {
-      while ( ! stackEmpty (opStack))    
-      {
-        sc = (unsigned long int) stackPeek(opStack);
-
-        /* While there is an operator token, o2, at the top of the opStack
-         * op1 is left-associative and its precedence is less than or equal to that of op2,
-         * or op1 is right-associative and its precedence is less than that of op2,
-         */
-        if (is_operator(sc) &&
-            ((op_left_assoc(c) && (op_preced(c) <= op_preced(sc))) ||
-             (!op_left_assoc(c) && (op_preced(c) < op_preced(sc)))))   
-        {
-          /* Pop o2 off the opStack, onto the outStack queue; */
-          stackPushOp (outputStack, (uint64) stackPop(opStack));
-        }
-        else
-          break;
-      }
-
-      /*  push op1 onto the opStack. */
-      stackPush (opStack, (void *) c);
-    }
-    /* If the token is a left paren, then push it onto the opStack. */
-    else if (c == '(')
+    fsWriterText (w, "file");
+    for (j = 0; j < n; j++)
     {
-      stackPush (opStack, (void *) c);
-      pe = TRUE;
+      fsWriterText (w, ",");
+      csvField (w, files[j]);
     }
-    /* If the token is a right paren */
-    else if (c == ')')
-    {
-      pe = FALSE;
+    fsWriterText (w, "\n");
 
-      /* Until the token at the top of the opStack is a left paren,
-       * pop operators off the opStack and onto the output queue
-       */
-      while ( ! stackEmpty (opStack))
+    for (i = 0; i < n; i++)
+    {
+      csvField (w, files[i]);
+      for (j = 0; j < n; j++)
       {
-        sc = (uint64) stackPeek (opStack);
-        if (sc == '(')
-        {
-          pe = TRUE;
-          break;
-        }
+        fsWriterText (w, ",");
+        if (jac)
+          jaccardWrite (w, counts, n, i, j);
         else
-          stackPushOp(outputStack, (uint64) stackPop (opStack));
-      }
-
-      /* mismatched paren's if the opStack empties without a left paren */
-      if (pe == FALSE) {
-        fprintf (stderr, "1: Error: parentheses mismatched\n");
-        stackDump (opStack);
-        return FALSE;
+          fsWriterNumber (w, counts[i * n + j]);
       }
-
-      stackPop(opStack);  /* Pop the left paren from the opStack, but not onto the output queue. */
-   }
-    
-   /* 
-    * Since the token is not an operator or paren, treat
-    * it as a file by adding it to the output queue.
-    */
-   else 
-     stackPushFile (outputStack, tok);
-
-
-    tok = strtok(NULL, " ");
+      fsWriterText (w, "\n");
+    }
+    return;
   }
 
-  /* When there are no more tokens to read and
-   * while there are still operator tokens in the opStack:
-   */
-  while ( ! stackEmpty (opStack))
+  fsWriterText (w, "{\n  \"files\": [");
+  for (i = 0; i < n; i++)
   {
-    sc = (uint64) stackPop (opStack);
-    if (sc == '(' || sc == ')')   
+    fsWriterText (w, i ? ", " : "");
+    jsonString (w, files[i]);
+  }
+  fsWriterText (w, "],\n  \"sizes\": [");
+  for (i = 0; i < n; i++)
+  {
+    fsWriterText (w, i ? ", " : "");
+    fsWriterNumber (w, counts[i * n + i]);
+  }
+  fsWriterText (w, "],\n  \"intersections\": [");
+  for (i = 0; i < n; i++)
+  {
+    fsWriterText (w, i ? ",\n    [" : "\n    [");
+    for (j = 0; j < n; j++)
     {
-      fprintf (stderr, "2: Error: parentheses mismatched\n");
-      return FALSE;
+      fsWriterText (w, j ? ", " : "");
+      fsWriterNumber (w, counts[i * n + j]);
     }
-    stackPushOp(outputStack, sc);
+    fsWriterText (w, "]");
   }
-  return TRUE;
-}
- 
-Set * 
-execute (Stack * input) 
-{
-  Token * tok;
-  Set   * s1, * s2;
-  Stack * opStack;
-  uint32  opCnt    = 0;
-
-  if (Verbose) printf ("order:\n");
-
-  opStack = stackNew();
-
-  tok = stackShift (input);
-  while (tok != NULL)  
+  fsWriterText (w, n ? "\n  ]" : "]");
+  if (jac)
   {
-    if (tok->type == OPERATOR)
+    fsWriterText (w, ",\n  \"jaccard\": [");
+    for (i = 0; i < n; i++)
     {
-      /* printf ("tok->operator= %c\n", tok->x.operator); */
-      if (Verbose) fprintf (stderr, "%02d = ", opCnt);
-
-      opCnt++;
-
-      /* 
-       * Each operator takes a defined number of arguments. Err
-       * if there are fewer than the expected num on the stack.
-       */
-      if (stackDepth(opStack) < op_arg_count(tok->x.operator)) 
-      {
-        fprintf (stderr, 
-                 "execution_order(): insufficient values for the current operater (%c)\n", 
-                 (char) tok->x.operator);
-        return FALSE;
-      }
-
-      /* Else, Pop the top n values from the stack. */
-      if (tok->x.operator == 'I')
-        s1 = setInvert (stackPop (opStack)); 
-      else /* U, X, D */
+      fsWriterText (w, i ? ",\n    [" : "\n    [");
+      for (j = 0; j < n; j++)
       {
-        s2 = stackPop(opStack);
-        s1 = stackPop(opStack);
-
-        switch (tok->x.operator) 
-        {
-          case 'U':
-            s1 = setUnion(s1, s2);
-            break;
-          case 'D':
-            s1 = setDiff(s1, s2);
-            break;
-          case 'X':
-            s1 = setIntersect(s1, s2);
-            break;
-          default:
-            assert(0);
-        }
+        fsWriterText (w, j ? ", " : "");
+        jaccardWrite (w, counts, n, i, j);
       }
-
-      /* Push the returned results */
-      stackPush(opStack, s1);
+      fsWriterText (w, "]");
     }
-    else  /* If the token is a value */
-      stackPush(opStack, tok);
-
-    tok = stackShift (input);
+    fsWriterText (w, n ? "\n  ]" : "]");
   }
+  fsWriterText (w, "\n}\n");
+}
 
-  /* If there is only one value in the stack,
-   * that value is the result of the calculation.
-   */
-  if (stackDepth (opStack) == 1) 
-  {
-    s1 = stackPop (opStack);
-
-    if (s1->type == SFILE)
-      setRead(s1);
-
-    if (s1->type != SET)
-    {
-      fprintf (stderr, "execute(): result != a Set\n");
-      exit (-1);
-    }
+/* Write a sample, shuffled first if asked */
+FsStatus
+sampleWrite (FsContext * ctx, FILE * fp, uint32_t * ids, uint64_t n, boolean shuffle)
+{
+  FsWriter * w;
+  FsStatus   status;
 
-    return ((Set * ) s1);
+  if (shuffle)
+    fsShuffleIds (ctx, ids, n);
+  if ((status = fsWriterOpen (ctx, fp, &w)) == FS_OK)
+  {
+    fsWriterIds (w, ids, n);
+    status = fsWriterClose (ctx, w);
   }
+  fsFree (ctx, ids);
 
-  /* Anything but one value on the output stack is an error. */
-  return NULL;
+  return (status);
 }
 
-char *
-cmdLine (int argc, char *argv[])
+/* Write a rank, on a line of its own */
+FsStatus
+rankWrite (FsContext * ctx, FILE * fp, uint64_t rank)
 {
-  int i;
-  char * buf;
-
-  buf = malloc(MAX_EXP_LEN);
-  memset(buf, 0, MAX_EXP_LEN);
-
-  for (i = 0; i < argc; i++) {
-    strcat (buf, argv[i]);
-    strcat (buf, " ");
-  }
+  FsWriter * w;
+  FsStatus   status;
+
+  if ((status = fsWriterOpen (ctx, fp, &w)) != FS_OK)
+    return (status);
+  fsWriterNumber (w, rank);
+  fsWriterText (w, "\n");
+  return (fsWriterClose (ctx, w));
+}
 
-  return (buf);
+/*
+ * Report a failed library call and exit.
+ */
+void
+fail (FsContext * ctx, FsStatus status, const char * input)
+{
+  fprintf (stderr, "\nfilesets: ERROR: %s\n", fsErrorMessage (ctx));
+  if (status == FS_ESYNTAX)
+    fprintf (stderr, "\nfile-sets: ERROR: Invalid input\n\t%s\n", input);
+  fprintf (stderr, "\n");
+  exit(-1);
 }
 
 int 
 main (int argc, char *argv[]) 
 {
-  char    input[MAX_EXP_LEN];
-  FILE  * outFile;
-  Stack * outputStack;
-  char  * currPos;
-  int     i;
-  size_t  len;
-  boolean shuffle = FALSE;
-  Set   * resultSet;
+  char      * input = NULL;
+  FILE      * outFile;
+  int         i;
+  size_t      len = 0;
+  boolean     shuffle = FALSE;
+  boolean     ranges  = FALSE;
+  boolean     verbose = FALSE;
+  boolean     hugePages = TRUE;
+  long        maxSetVal = -1;
+  long        threads   = 1;
+  FsContext * ctx;
+  FsSet     * resultSet, * added, * removed;
+  FsStatus    status;
+  char      * exprFile = NULL;
+  char      * listFile = NULL;
+  char        listOp   = 0;
+  char      * stateFile = NULL;
+  boolean     deltaOnly = FALSE;
+  boolean     binary    = FALSE;
+  boolean     page      = FALSE;
+  unsigned long offset  = 0;
+  uint64_t    limit     = FS_NO_LIMIT;
+  unsigned long first = 1, last = UINT_MAX;
+  boolean     rank      = FALSE;
+  unsigned long rankId  = 0;
+  uint64_t    rankVal;
+  char      * binFile;
+  boolean     overlap = FALSE;
+  boolean     json    = FALSE;
+  boolean     jac     = FALSE;
+  char     ** files   = NULL;
+  int         fileCnt = 0;
+  uint64_t  * counts;
+  FsWriter  * writer;
+  char      * tok, * save;
+  boolean     sample  = FALSE;
+  unsigned long sampleK = 0;
+  unsigned long strata  = 1;
+  boolean     seeded  = FALSE;
+  unsigned long seed    = 0;
+  uint32_t  * ids;
+  uint64_t    idCnt;
+  uint64_t    memLimit = 0;
 
   if (argc == 1)
     usage();
 
   outFile = stdout;
-  outputStack = stackNew();
-
-  memset(input, 0, MAX_EXP_LEN);
-  currPos = input;
 
   for (i = 1; i < argc; i++) 
   {
@@ -902,7 +506,7 @@ main (int argc, char *argv[])
  
      if (strcmp(argv[i], "-v") == 0)
     {
-      Verbose = TRUE;
+      verbose = TRUE;
       continue;
     }
 
@@ -926,58 +530,399 @@ main (int argc, char *argv[])
     if (strcmp(argv[i], "-max") == 0)
     {
       i++;
-      MaxSetVal = strtol(argv[i], NULL, 10);
-      if (MaxSetVal == 0 || MaxSetVal == UINT_MAX)
+      maxSetVal = strtol(argv[i], NULL, 10);
+      if (maxSetVal <= 0 || maxSetVal >= UINT_MAX)
       {
         fprintf (stderr, "\nfilesets: ERROR: Max Id must be an integer greater than zero.\n");
         usage();
       }
       continue;
     }
+
+    if (strcmp(argv[i], "-t") == 0)
+    {
+      if (++i == argc)
+        usage();
+      threads = strtol(argv[i], NULL, 10);
+      if (threads < 1 || threads > FS_MAX_THREADS)
+      {
+        fprintf (stderr, "\nfilesets: ERROR: threads must be between 1 and %d.\n", FS_MAX_THREADS);
+        usage();
+      }
+      continue;
+    }
+
+    if (strcmp(argv[i], "-nohuge") == 0)
+    {
+      hugePages = FALSE;
+      continue;
+    }
+
+    if (strcmp(argv[i], "-r") == 0)
+    {
+      ranges = TRUE;
+      continue;
+    }
+
+    if (strcmp(argv[i], "-i") == 0)
+    {
+      if (++i == argc)
+        usage();
+      stateFile = argv[i];
+      continue;
+    }
+
+    if (strcmp(argv[i], "-delta") == 0)
+    {
+      deltaOnly = TRUE;
+      continue;
+    }
+
+    if (strcmp(argv[i], "-b") == 0)
+    {
+      binary = TRUE;
+      continue;
+    }
+
+    if (strcmp(argv[i], "-offset") == 0)
+    {
+      i++;
+      offset = optionValue ("-offset", argv[i]);
+      page = TRUE;
+      continue;
+    }
+
+    if (strcmp(argv[i], "-limit") == 0)
+    {
+      i++;
+      limit = optionValue ("-limit", argv[i]);
+      page = TRUE;
+      continue;
+    }
+
+    if (strcmp(argv[i], "-idrange") == 0)
+    {
+      if (++i == argc || sscanf (argv[i], "%lu:%lu", &first, &last) != 2 || first > last)
+      {
+        fprintf (stderr, "\nfilesets: ERROR: -idrange requires first:last with first <= last.\n");
+        usage();
+      }
+      page = TRUE;
+      continue;
+    }
+
+    if (strcmp(argv[i], "-rank") == 0)
+    {
+      i++;
+      rankId = optionValue ("-rank", argv[i]);
+      rank = TRUE;
+      continue;
+    }
+
+    if (strcmp(argv[i], "-n") == 0)
+    {
+      i++;
+      sampleK = optionValue ("-n", argv[i]);
+      sample = TRUE;
+      continue;
+    }
+
+    if (strcmp(argv[i], "-strata") == 0)
+    {
+      i++;
+      strata = optionValue ("-strata", argv[i]);
+      if (strata < 1 || strata > UINT_MAX)
+      {
+        fprintf (stderr, "\nfilesets: ERROR: -strata must be at least 1.\n");
+        usage();
+      }
+      continue;
+    }
+
+    if (strcmp(argv[i], "-seed") == 0)
+    {
+      i++;
+      seed = optionValue ("-seed", argv[i]);
+      seeded = TRUE;
+      continue;
+    }
+
+    if (strcmp(argv[i], "-mem") == 0)
+    {
+      i++;
+      memLimit = byteValue ("-mem", argv[i]);
+      continue;
+    }
+
+    if (strcmp(argv[i], "-overlap") == 0)
+    {
+      overlap = TRUE;
+      continue;
+    }
+
+    if (strcmp(argv[i], "-json") == 0)
+    {
+      json = TRUE;
+      continue;
+    }
+
+    if (strcmp(argv[i], "-jaccard") == 0)
+    {
+      jac = TRUE;
+      continue;
+    }
+
+    if (strcmp(argv[i], "-f") == 0)
+    {
+      if (++i == argc)
+        usage();
+      exprFile = argv[i];
+      continue;
+    }
+
+    if (strcmp(argv[i], "-U") == 0 || strcmp(argv[i], "-X") == 0)
+    {
+      listOp = argv[i][1];
+      if (++i == argc)
+        usage();
+      listFile = argv[i];
+      continue;
+    }
     
-    len = strlen(argv[i]);
-    memcpy (currPos, argv[i], len);
-    currPos += len;
-    memcpy(currPos, " ", 1);
-    currPos++;
+    input = strAppend (input, &len, argv[i]);
+  }
+
+  if ((input != NULL) + (exprFile != NULL) + (listFile != NULL) != 1)
+  {
+    fprintf (stderr, "\nfilesets: ERROR: Specify exactly one of: an expression, -f exprfile, -U or -X listfile.\n");
+    usage();
   }
 
-  if (Verbose) fprintf (stderr, "input: %s\n", input);
+  if (ranges && (shuffle || deltaOnly))
+  {
+    fprintf (stderr, "\nfilesets: ERROR: -r can't be combined with -s or -delta.\n");
+    usage();
+  }
 
-  if (MaxSetVal == -1)
+  if (binary && (shuffle || ranges || deltaOnly))
+  {
+    fprintf (stderr, "\nfilesets: ERROR: -b can't be combined with -s, -r or -delta.\n");
+    usage();
+  }
+
+  if ((page || rank) && (shuffle || deltaOnly || binary || stateFile))
+  {
+    fprintf (stderr, "\nfilesets: ERROR: -offset, -limit, -idrange and -rank can't be combined with -s, -b, -i or -delta.\n");
+    usage();
+  }
+
+  if (page && rank)
+  {
+    fprintf (stderr, "\nfilesets: ERROR: -rank can't be combined with -offset, -limit or -idrange.\n");
+    usage();
+  }
+
+  if (sample && (ranges || deltaOnly || binary || page || rank))
+  {
+    fprintf (stderr, "\nfilesets: ERROR: -n can't be combined with -r, -b, -delta, -offset, -limit, -idrange or -rank.\n");
+    usage();
+  }
+
+  if (strata > 1 && ! sample)
+  {
+    fprintf (stderr, "\nfilesets: ERROR: -strata requires -n.\n");
+    usage();
+  }
+
+  if (overlap && (shuffle || ranges || deltaOnly || binary || page || rank || sample || stateFile || listFile))
+  {
+    fprintf (stderr, "\nfilesets: ERROR: -overlap only takes files, with -json and -jaccard.\n");
+    usage();
+  }
+
+  if (memLimit && (shuffle || binary || stateFile || page || rank || sample || overlap))
+  {
+    fprintf (stderr, "\nfilesets: ERROR: -mem can't be combined with -s, -b, -i, -offset, -limit, -idrange, -rank, -n or -overlap.\n");
+    usage();
+  }
+
+  if ((json || jac) && ! overlap)
+  {
+    fprintf (stderr, "\nfilesets: ERROR: -json and -jaccard require -overlap.\n");
+    usage();
+  }
+
+  if (deltaOnly && stateFile == NULL)
+  {
+    fprintf (stderr, "\nfilesets: ERROR: -delta requires -i statefile.\n");
+    usage();
+  }
+
+  if (exprFile)
+    input = fileSlurp (exprFile);
+  else if (listFile)
+    input = listToExpression (listFile, listOp);
+
+  if (verbose) fprintf (stderr, "input: %s\n", input);
+
+  if (maxSetVal == -1)
   {
     fprintf (stderr, "\nfilesets: ERROR: The max ID (-max) is a required option and must be positive integer.\n");
     usage();
   }
 
-  if (convertToPostfix (input, outputStack))
+  if (fsContextNew (&ctx, maxSetVal, NULL) != FS_OK)
   {
-    /*
-    for (i = 0; Verbose && i < outputStack.depth; i++)
+    fprintf (stderr, "\nfilesets: ERROR: can't create a context\n\n");
+    exit(-1);
+  }
+  fsContextThreads (ctx, threads);
+  fsContextHugePages (ctx, hugePages);
+  fsContextVerbose (ctx, verbose);
+  if (seeded)
+    fsContextSeed (ctx, seed);
+  fsContextMemLimit (ctx, memLimit);
+
+  if (overlap)
+  {
+    for (tok = strtok_r (input, " \t\r\n", &save); tok != NULL; tok = strtok_r (NULL, " \t\r\n", &save))
     {
-      Token * t;
-      t = (Token *) outputStack.data[i];
-      if (t->type == OPERATOR)
-        fprintf (stderr, "%d \t %c \n", i, t->x.operator);
-      else
-        fprintf (stderr, "%d \t %s \n", i, t->x.file);
+      if ((files = realloc (files, sizeof(char *) * (fileCnt + 1))) == NULL)
+      {
+        fprintf (stderr, "\nfilesets: ERROR: can't realloc() the file list\n\n");
+        exit(-1);
+      }
+      files[fileCnt++] = tok;
+    }
+    if (fileCnt == 0)
+    {
+      fprintf (stderr, "\nfilesets: ERROR: -overlap needs at least one file\n\n");
+      exit(-1);
+    }
+    if ((size_t) fileCnt > SIZE_MAX / fileCnt ||
+        (counts = calloc ((size_t) fileCnt * fileCnt, sizeof(uint64_t))) == NULL)
+    {
+      fprintf (stderr, "\nfilesets: ERROR: can't malloc() the overlap matrix\n\n");
+      exit(-1);
     }
-    */
 
-    resultSet = execute (outputStack);
-    if (resultSet) 
+    if ((status = fsOverlap (ctx, (const char * const *) files, fileCnt, counts)) != FS_OK ||
+        (status = fsWriterOpen (ctx, outFile, &writer)) != FS_OK)
+      fail (ctx, status, input);
+    overlapWrite (writer, files, fileCnt, counts, json, jac);
+    if ((status = fsWriterClose (ctx, writer)) != FS_OK)
+      fail (ctx, status, input);
+    if (fclose (outFile) != 0)
+    {
+      fprintf (stderr, "\nfilesets: ERROR: Can't write output file\n\n");
+      exit(-1);
+    }
+
+    free(counts);
+    free(files);
+    fsContextFree (ctx);
+    free(input);
+    return 0;
+  }
+
+  /* queries on a lone binary set file don't need it loaded */
+  if ((page || rank || (sample && ! stateFile)) && (binFile = binaryOperand (input)) != NULL)
+  {
+    if (verbose) fprintf (stderr, "index: %s\n", binFile);
+    if (sample)
+    {
+      if ((status = fsFileSample (ctx, binFile, sampleK, strata, &ids, &idCnt)) == FS_OK)
+        status = sampleWrite (ctx, outFile, ids, idCnt, shuffle);
+    }
+    else if (rank)
     {
-      if (shuffle == TRUE)
-        setShuffleAndWrite (resultSet, outFile);
-      else
-        setWrite (resultSet, outFile);
+      if ((status = fsFileRank (ctx, binFile, rankId > UINT_MAX ? UINT_MAX : rankId, &rankVal)) == FS_OK)
+        status = rankWrite (ctx, outFile, rankVal);
     }
     else
+      status = fsFileWritePage (ctx, binFile, outFile, ranges ? FS_FORMAT_RANGES : FS_FORMAT_IDS,
+                                first, last > UINT_MAX ? UINT_MAX : last, offset, limit);
+    if (status != FS_OK)
+      fail (ctx, status, input);
+    if (fclose (outFile) != 0)
     {
-      fprintf (stderr, "\nfile-sets: ERROR: Invalid input\n\t%s\n", cmdLine(argc, argv));
+      fprintf (stderr, "\nfilesets: ERROR: Can't write output file\n\n");
       exit(-1);
     }
-    
+    fsContextFree (ctx);
+    free(input);
+    return 0;
+  }
+
+  if (verbose) printf ("order:\n");
+
+  /* the result is written as it is evaluated, range by range if need be */
+  if (memLimit)
+  {
+    if ((status = fsEvalWrite (ctx, input, outFile, ranges ? FS_FORMAT_RANGES : FS_FORMAT_IDS)) != FS_OK)
+      fail (ctx, status, (exprFile || listFile) ? input : cmdLine(argc, argv));
+    if (fclose (outFile) != 0)
+    {
+      fprintf (stderr, "\nfilesets: ERROR: Can't write output file\n\n");
+      exit(-1);
+    }
+    fsContextFree (ctx);
+    free(input);
+    return 0;
   }
+
+  if (stateFile)
+    status = fsEvalIncremental (ctx, input, stateFile, &resultSet,
+                                deltaOnly ? &added : NULL, deltaOnly ? &removed : NULL);
+  else
+    status = fsEval (ctx, input, &resultSet);
+  if (status != FS_OK)
+    fail (ctx, status, (exprFile || listFile) ? input : cmdLine(argc, argv));
+
+  if (verbose && ! deltaOnly) printf ("Output:\n");
+
+  if (deltaOnly)
+  {
+    if ((status = fsSetWrite (ctx, added, outFile, FS_FORMAT_ADDED)) == FS_OK)
+      status = fsSetWrite (ctx, removed, outFile, FS_FORMAT_REMOVED);
+  }
+  else if (sample)
+  {
+    if ((status = fsSetSample (ctx, resultSet, sampleK, strata, &ids, &idCnt)) == FS_OK)
+      status = sampleWrite (ctx, outFile, ids, idCnt, shuffle);
+  }
+  else if (rank)
+  {
+    if ((status = fsSetRank (ctx, resultSet, rankId > UINT_MAX ? UINT_MAX : rankId, &rankVal)) == FS_OK)
+      status = rankWrite (ctx, outFile, rankVal);
+  }
+  else if (page)
+    status = fsSetWritePage (ctx, resultSet, outFile, ranges ? FS_FORMAT_RANGES : FS_FORMAT_IDS,
+                             first, last > UINT_MAX ? UINT_MAX : last, offset, limit);
+  else if (binary)
+    status = fsSetWrite (ctx, resultSet, outFile, FS_FORMAT_BINARY);
+  else if (shuffle == TRUE)
+    status = fsSetWrite (ctx, resultSet, outFile, FS_FORMAT_SHUFFLED);
+  else if (ranges == TRUE)
+    status = fsSetWrite (ctx, resultSet, outFile, FS_FORMAT_RANGES);
+  else
+    status = fsSetWrite (ctx, resultSet, outFile, FS_FORMAT_IDS);
+  if (status != FS_OK)
+    fail (ctx, status, input);
+  if (fclose (outFile) != 0)
+  {
+    fprintf (stderr, "\nfilesets: ERROR: Can't write output file\n\n");
+    exit(-1);
+  }
+
+  fsSetFree (ctx, resultSet);
+  if (deltaOnly)
+  {
+    fsSetFree (ctx, added);
+    fsSetFree (ctx, removed);
+  }
+  fsContextFree (ctx);
+  free(input);
+
   return 0;
 }
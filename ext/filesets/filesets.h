@@ -0,0 +1,181 @@
+/*
+ * libfilesets: set operations (union, intersection, difference,
+ * complement, threshold) on positive integer IDs up to a max ID. A set
+ * is a vector with one byte per possible ID.
+ *
+ * All state lives in an FsContext: the max ID, threads, huge pages,
+ * the allocator and the last error. The library has no globals, so
+ * independent contexts can be used from different threads at once; a
+ * single context (and the sets made with it) must only be used by one
+ * thread at a time. Sets may be passed between contexts that have the
+ * same max ID and allocator.
+ *
+ * Every call that can fail returns an FsStatus; on failure the reason
+ * is in fsErrorMessage() and nothing is leaked. filesets.hpp wraps the
+ * API for C++.
+ */
+#ifndef FILESETS_H
+#define FILESETS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FS_MAX_THREADS  64
+
+typedef enum _FsStatus
+{
+  FS_OK      = 0,
+  FS_ENOMEM  = 1,     /* an allocation failed */
+  FS_EIO     = 2,     /* a file couldn't be opened, read or written */
+  FS_ERANGE  = 3,     /* an input ID is greater than the max ID */
+  FS_ESYNTAX = 4,     /* the expression is malformed */
+  FS_EINVAL  = 5      /* a bad argument */
+} FsStatus;
+
+/*
+ * Where the library gets memory: small allocations, and set vectors
+ * when one is supplied (otherwise vectors are mmap()'ed, with huge
+ * pages where possible). arg is passed through to every call.
+ */
+typedef struct _FsAllocator {
+  void * (* alloc)   (void * arg, size_t size);
+  void * (* realloc) (void * arg, void * p, size_t size);
+  void   (* free)    (void * arg, void * p);
+  void   * arg;
+} FsAllocator;
+
+/* How fsSetWrite() writes a set: one line per ID or range, or binary */
+typedef enum _FsFormat
+{
+  FS_FORMAT_IDS      = 0,   /* id, ascending */
+  FS_FORMAT_RANGES   = 1,   /* first-last for each run of consecutive IDs */
+  FS_FORMAT_SHUFFLED = 2,   /* id, in random order */
+  FS_FORMAT_ADDED    = 3,   /* +id */
+  FS_FORMAT_REMOVED  = 4,   /* -id */
+  FS_FORMAT_BINARY   = 5    /* a bit vector with a rank index, not lines (fsSetWrite() only) */
+} FsFormat;
+
+/* No limit on the IDs fsSetWritePage() writes */
+#define FS_NO_LIMIT  UINT64_MAX
+
+typedef struct _FsContext FsContext;
+typedef struct _Token     FsSet;
+
+/* Contexts. alloc may be NULL for the default allocator. */
+FsStatus     fsContextNew (FsContext ** ctx, uint32_t maxId, const FsAllocator * alloc);
+void         fsContextFree (FsContext * ctx);
+uint32_t     fsContextMax (const FsContext * ctx);
+FsStatus     fsContextThreads (FsContext * ctx, uint32_t threads);
+void         fsContextHugePages (FsContext * ctx, int on);
+void         fsContextVerbose (FsContext * ctx, int on);
+void         fsContextSeed (FsContext * ctx, uint64_t seed);
+void         fsContextMemLimit (FsContext * ctx, uint64_t bytes);
+const char * fsErrorMessage (const FsContext * ctx);
+const char * fsStatusName (FsStatus status);
+void         fsFree (FsContext * ctx, void * p);
+
+/* Sets */
+FsStatus     fsSetNew (FsContext * ctx, FsSet ** set);
+FsStatus     fsSetLoad (FsContext * ctx, const char * file, FsSet ** set);
+FsStatus     fsSetFromIds (FsContext * ctx, const uint32_t * ids, uint64_t n, FsSet ** set);
+FsStatus     fsSetCopy (FsContext * ctx, const FsSet * s, FsSet ** set);
+void         fsSetFree (FsContext * ctx, FsSet * s);
+FsStatus     fsSetFold (FsContext * ctx, FsSet * acc, char op, FsSet * const * sets, uint32_t n);
+FsStatus     fsSetInvert (FsContext * ctx, FsSet * s);
+uint64_t     fsSetCount (FsContext * ctx, const FsSet * s);
+uint64_t     fsSetIds (FsContext * ctx, const FsSet * s, uint32_t * cursor, uint32_t * ids, uint64_t n);
+FsStatus     fsSetShuffle (FsContext * ctx, const FsSet * s, uint32_t ** ids, uint64_t * n);
+FsStatus     fsSetWrite (FsContext * ctx, FsSet * s, FILE * fp, FsFormat format);
+const char * fsSetHistory (const FsSet * s);
+
+/*
+ * Rank and select. A set's rank index (the number of members before
+ * each block of 4096 IDs) is built by the first of these calls and
+ * kept until the set changes, so each query only scans one block. The
+ * rank of id is the number of members less than id, which is the
+ * offset id has (or would have) in sorted order; select finds the
+ * member at offset k (FS_ERANGE if k >= the count). A page is the
+ * members in [first, last], less the first offset of them, at most
+ * limit of them, written as FS_FORMAT_IDS or FS_FORMAT_RANGES.
+ *
+ * The fsFile* calls answer the same queries straight from a binary set
+ * file (FS_FORMAT_BINARY), reading only its index and the blocks they
+ * need. Binary set files can also be used anywhere a file can.
+ */
+FsStatus     fsSetRank (FsContext * ctx, FsSet * s, uint32_t id, uint64_t * rank);
+FsStatus     fsSetSelect (FsContext * ctx, FsSet * s, uint64_t k, uint32_t * id);
+FsStatus     fsSetWritePage (FsContext * ctx, FsSet * s, FILE * fp, FsFormat format,
+                             uint32_t first, uint32_t last, uint64_t offset, uint64_t limit);
+int          fsFileIsBinary (const char * file);
+FsStatus     fsFileRank (FsContext * ctx, const char * file, uint32_t id, uint64_t * rank);
+FsStatus     fsFileSelect (FsContext * ctx, const char * file, uint64_t k, uint32_t * id);
+FsStatus     fsFileWritePage (FsContext * ctx, const char * file, FILE * fp, FsFormat format,
+                              uint32_t first, uint32_t last, uint64_t offset, uint64_t limit);
+
+/*
+ * Sampling: k members chosen uniformly without replacement (all of
+ * them if there are no more), as an array of *n ascending IDs to free
+ * with fsFree(). With strata > 1 the IDs 1..max are split into that
+ * many equal ranges, and each range gets a share of k in proportion to
+ * its members. Floyd's algorithm picks offsets and the rank index
+ * finds them, so the cost is in k and the index, not the set's size.
+ * fsShuffleIds() puts ids in random order. Both draw on the context's
+ * generator (fsContextSeed()).
+ */
+FsStatus     fsSetSample (FsContext * ctx, FsSet * s, uint64_t k, uint32_t strata, uint32_t ** ids, uint64_t * n);
+FsStatus     fsFileSample (FsContext * ctx, const char * file, uint64_t k, uint32_t strata,
+                           uint32_t ** ids, uint64_t * n);
+void         fsShuffleIds (FsContext * ctx, uint32_t * ids, uint64_t n);
+
+/*
+ * All-pairs overlap: fill counts, an n x n row-major matrix, with the
+ * size of the intersection of every pair of files (so the diagonal
+ * holds their sizes). Each file is read once and kept packed one bit
+ * per ID while the pairs are counted.
+ */
+FsStatus     fsOverlap (FsContext * ctx, const char * const * files, uint32_t n, uint64_t * counts);
+
+/* Expressions */
+FsStatus     fsEval (FsContext * ctx, const char * expr, FsSet ** result);
+FsStatus     fsEvalIncremental (FsContext * ctx, const char * expr, const char * stateFile,
+                                FsSet ** result, FsSet ** added, FsSet ** removed);
+
+/*
+ * Evaluate and write in one call, keeping the set vectors held at once,
+ * and the buffers for parsing, splitting and writing, within the
+ * context's memory limit (fsContextMemLimit(), 0 for none; FS_ENOMEM if
+ * it can't hold the buffers and one pass).
+ * Over the limit, each input is split into temporary files per range
+ * of IDs under $TMPDIR, and the ranges are evaluated and written one at
+ * a time, in order, each range's result written by a thread while the
+ * next is evaluated (which the limit counts as one more vector); then
+ * only FS_FORMAT_IDS and FS_FORMAT_RANGES can be written (FS_EINVAL
+ * otherwise).
+ */
+FsStatus     fsEvalWrite (FsContext * ctx, const char * expr, FILE * fp, FsFormat format);
+
+/*
+ * Other output through the same writer as fsSetWrite(): lines are
+ * formatted into buffers that a thread writes to fp, so formatting
+ * overlaps the writes. Text and decimal numbers are appended in order;
+ * fsWriterIds() writes n IDs, one per line. fsWriterClose() writes the
+ * rest, frees the writer and reports any error writing fp.
+ */
+typedef struct _Writer FsWriter;
+
+FsStatus     fsWriterOpen (FsContext * ctx, FILE * fp, FsWriter ** w);
+void         fsWriterText (FsWriter * w, const char * text);
+void         fsWriterNumber (FsWriter * w, uint64_t n);
+void         fsWriterIds (FsWriter * w, const uint32_t * ids, uint64_t n);
+FsStatus     fsWriterClose (FsContext * ctx, FsWriter * w);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,312 @@
+/*
+ * filesets.hpp: header-only C++ wrapper for libfilesets (filesets.h).
+ *
+ * Context and Set own their handles and are move-only; failures throw
+ * filesets::Error with the library's status and message. A Set keeps
+ * the raw context handle it was made with, so its Context must outlive
+ * it (moving the Context is fine).
+ *
+ *   filesets::Context ctx (20000000);
+ *   filesets::Set active = filesets::Set::load (ctx, "active.txt");
+ *   active &= filesets::Set::load (ctx, "opted_in.txt");
+ *   std::vector<uint32_t> ids = active.ids ();
+ */
+#ifndef FILESETS_HPP
+#define FILESETS_HPP
+
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "filesets.h"
+
+namespace filesets {
+
+class Error : public std::runtime_error
+{
+ public:
+  Error (FsStatus status, const std::string & what)
+    : std::runtime_error (what), status_ (status) {}
+
+  FsStatus status () const { return status_; }
+
+ private:
+  FsStatus status_;
+};
+
+inline void
+check (FsContext * ctx, FsStatus status)
+{
+  if (status != FS_OK)
+    throw Error (status, fsErrorMessage (ctx));
+}
+
+class Set;
+
+struct Incremental;
+
+class Context
+{
+ public:
+  explicit Context (uint32_t maxId, const FsAllocator * alloc = nullptr)
+  {
+    FsStatus status = fsContextNew (&ctx_, maxId, alloc);
+    if (status != FS_OK)
+      throw Error (status, fsStatusName (status));
+  }
+
+  ~Context () { fsContextFree (ctx_); }
+
+  Context (Context && other) noexcept : ctx_ (other.ctx_) { other.ctx_ = nullptr; }
+  Context & operator= (Context && other) noexcept { std::swap (ctx_, other.ctx_); return *this; }
+  Context (const Context &) = delete;
+  Context & operator= (const Context &) = delete;
+
+  FsContext * get () const { return ctx_; }
+  uint32_t    max () const { return fsContextMax (ctx_); }
+
+  Context & threads (uint32_t n)  { check (ctx_, fsContextThreads (ctx_, n)); return *this; }
+  Context & hugePages (bool on)   { fsContextHugePages (ctx_, on); return *this; }
+  Context & verbose (bool on)     { fsContextVerbose (ctx_, on); return *this; }
+  Context & seed (uint64_t seed)  { fsContextSeed (ctx_, seed); return *this; }
+  Context & memLimit (uint64_t b) { fsContextMemLimit (ctx_, b); return *this; }
+
+  Set         eval (const std::string & expr);
+  Incremental evalIncremental (const std::string & expr, const std::string & stateFile);
+
+  /* Evaluate and write within the memory limit */
+  void
+  evalWrite (const std::string & expr, FILE * fp, FsFormat format = FS_FORMAT_IDS)
+  {
+    check (ctx_, fsEvalWrite (ctx_, expr.c_str (), fp, format));
+  }
+
+  /* The intersection size of every pair of files, n x n row-major */
+  std::vector<uint64_t>
+  overlap (const std::vector<std::string> & files)
+  {
+    std::vector<const char *> names;
+    for (const std::string & f : files)
+      names.push_back (f.c_str ());
+    std::vector<uint64_t> counts (files.size () * files.size ());
+    check (ctx_, fsOverlap (ctx_, names.data (), names.size (), counts.data ()));
+    return counts;
+  }
+
+  /* Rank and select straight from a binary set file */
+  uint64_t
+  fileRank (const std::string & file, uint32_t id)
+  {
+    uint64_t r;
+    check (ctx_, fsFileRank (ctx_, file.c_str (), id, &r));
+    return r;
+  }
+
+  uint32_t
+  fileSelect (const std::string & file, uint64_t k)
+  {
+    uint32_t id;
+    check (ctx_, fsFileSelect (ctx_, file.c_str (), k, &id));
+    return id;
+  }
+
+ private:
+  FsContext * ctx_ = nullptr;
+};
+
+class Set
+{
+ public:
+  /* An empty handle, holding no set */
+  Set () {}
+
+  /* A new, empty set */
+  explicit Set (Context & ctx) : ctx_ (ctx.get ()) { check (ctx_, fsSetNew (ctx_, &set_)); }
+
+  /* Take ownership of a set made with the C API */
+  Set (Context & ctx, FsSet * set) : ctx_ (ctx.get ()), set_ (set) {}
+
+  static Set
+  load (Context & ctx, const std::string & file)
+  {
+    FsSet * s;
+    check (ctx.get (), fsSetLoad (ctx.get (), file.c_str (), &s));
+    return Set (ctx, s);
+  }
+
+  static Set
+  fromIds (Context & ctx, const std::vector<uint32_t> & ids)
+  {
+    FsSet * s;
+    check (ctx.get (), fsSetFromIds (ctx.get (), ids.data (), ids.size (), &s));
+    return Set (ctx, s);
+  }
+
+  ~Set () { if (set_) fsSetFree (ctx_, set_); }
+
+  Set (Set && other) noexcept : ctx_ (other.ctx_), set_ (other.set_) { other.set_ = nullptr; }
+  Set & operator= (Set && other) noexcept
+  {
+    std::swap (ctx_, other.ctx_);
+    std::swap (set_, other.set_);
+    return *this;
+  }
+  Set (const Set &) = delete;
+  Set & operator= (const Set &) = delete;
+
+  explicit operator bool () const { return set_ != nullptr; }
+  FsSet * get () const { return set_; }
+  FsSet * release () { FsSet * s = set_; set_ = nullptr; return s; }
+
+  Set
+  copy () const
+  {
+    Set c;
+    c.ctx_ = ctx_;
+    check (ctx_, fsSetCopy (ctx_, set_, &c.set_));
+    return c;
+  }
+
+  /* Fold any number of sets into this one with op (U, X or D) in one pass */
+  Set &
+  fold (char op, const std::vector<const Set *> & sets)
+  {
+    std::vector<FsSet *> raw;
+    for (const Set * s : sets)
+      raw.push_back (s->set_);
+    check (ctx_, fsSetFold (ctx_, set_, op, raw.data (), raw.size ()));
+    return *this;
+  }
+
+  Set & operator|= (const Set & other) { return fold ('U', { &other }); }
+  Set & operator&= (const Set & other) { return fold ('X', { &other }); }
+  Set & operator-= (const Set & other) { return fold ('D', { &other }); }
+
+  Set & invert () { check (ctx_, fsSetInvert (ctx_, set_)); return *this; }
+
+  uint64_t count () const { return fsSetCount (ctx_, set_); }
+
+  /* Call f(id) for each member in ascending order */
+  template <typename F>
+  void
+  forEach (F f) const
+  {
+    uint32_t cursor = 1;
+    uint32_t ids[4096];
+    uint64_t n, i;
+
+    while ((n = fsSetIds (ctx_, set_, &cursor, ids, 4096)) > 0)
+      for (i = 0; i < n; i++)
+        f (ids[i]);
+  }
+
+  std::vector<uint32_t>
+  ids () const
+  {
+    std::vector<uint32_t> v (count ());
+    uint32_t cursor = 1;
+
+    if ( ! v.empty ())
+      fsSetIds (ctx_, set_, &cursor, v.data (), v.size ());
+    return v;
+  }
+
+  std::vector<uint32_t>
+  shuffled () const
+  {
+    uint32_t * ids;
+    uint64_t   n;
+
+    check (ctx_, fsSetShuffle (ctx_, set_, &ids, &n));
+    std::vector<uint32_t> v (ids, ids + n);
+    fsFree (ctx_, ids);
+    return v;
+  }
+
+  void write (FILE * fp, FsFormat format = FS_FORMAT_IDS) { check (ctx_, fsSetWrite (ctx_, set_, fp, format)); }
+
+  /* The number of members less than id */
+  uint64_t
+  rank (uint32_t id) const
+  {
+    uint64_t r;
+    check (ctx_, fsSetRank (ctx_, set_, id, &r));
+    return r;
+  }
+
+  /* The member at offset k in ascending order */
+  uint32_t
+  select (uint64_t k) const
+  {
+    uint32_t id;
+    check (ctx_, fsSetSelect (ctx_, set_, k, &id));
+    return id;
+  }
+
+  /* k members chosen uniformly at random, ascending */
+  std::vector<uint32_t>
+  sample (uint64_t k, uint32_t strata = 1) const
+  {
+    uint32_t * ids;
+    uint64_t   n;
+
+    check (ctx_, fsSetSample (ctx_, set_, k, strata, &ids, &n));
+    std::vector<uint32_t> v (ids, ids + n);
+    fsFree (ctx_, ids);
+    return v;
+  }
+
+  void
+  writePage (FILE * fp, uint32_t first, uint32_t last, uint64_t offset, uint64_t limit = FS_NO_LIMIT,
+             FsFormat format = FS_FORMAT_IDS) const
+  {
+    check (ctx_, fsSetWritePage (ctx_, set_, fp, format, first, last, offset, limit));
+  }
+
+  const char * history () const { return fsSetHistory (set_); }
+
+ private:
+  FsContext * ctx_ = nullptr;
+  FsSet     * set_ = nullptr;
+};
+
+inline Set operator| (const Set & a, const Set & b) { Set r = a.copy (); r |= b; return r; }
+inline Set operator& (const Set & a, const Set & b) { Set r = a.copy (); r &= b; return r; }
+inline Set operator- (const Set & a, const Set & b) { Set r = a.copy (); r -= b; return r; }
+inline Set operator~ (const Set & a)                { Set r = a.copy (); r.invert (); return r; }
+
+/* The result of Context::evalIncremental() and how it changed since the saved run */
+struct Incremental
+{
+  Set result;
+  Set added;
+  Set removed;
+};
+
+inline Set
+Context::eval (const std::string & expr)
+{
+  FsSet * s;
+
+  check (ctx_, fsEval (ctx_, expr.c_str (), &s));
+  return Set (*this, s);
+}
+
+inline Incremental
+Context::evalIncremental (const std::string & expr, const std::string & stateFile)
+{
+  FsSet     * r, * a, * d;
+  Incremental inc;
+
+  check (ctx_, fsEvalIncremental (ctx_, expr.c_str (), stateFile.c_str (), &r, &a, &d));
+  inc.result  = Set (*this, r);
+  inc.added   = Set (*this, a);
+  inc.removed = Set (*this, d);
+  return inc;
+}
+
+}
+
+#endif
@@ -0,0 +1,73 @@
+#!/usr/bin/env ruby
+#
+# Times filesets on generated data, with and without huge pages and
+# with one thread and one thread per core. The files are in random
+# order; "load sorted" loads the first one sorted, for comparison.
+#
+# Usage: fs-bench.rb path_to_executable [max_id] [ids_per_file]
+#
+
+require 'etc'
+require 'tmpdir'
+
+if ARGV.size < 1
+  $stderr.puts "ERROR: Benchmark requires 1 arg: path to executable."
+  exit(1)
+end
+
+FileSet  = File.expand_path(ARGV[0])
+MAX_ID   = (ARGV[1] || 200_000_000).to_i
+ID_COUNT = (ARGV[2] || 2_000_000).to_i
+FILES    = 8
+
+def time_run(args)
+  start = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+  r = Kernel.system(FileSet, "-max", "#{MAX_ID}", "-o", "/dev/null", *args)
+  if r == false
+    $stderr.puts "\nBENCH FAILED: could not execute: #{args.join(' ')}\n\n"
+    exit(1)
+  end
+  Process.clock_gettime(Process::CLOCK_MONOTONIC) - start
+end
+
+Dir.mktmpdir("fs-bench") do |dir|
+  files = (1..FILES).map do |n|
+    path = "#{dir}/set#{n}.txt"
+    File.open(path, "w") do |f|
+      ID_COUNT.times { f.puts(rand(MAX_ID) + 1) }
+    end
+    path
+  end
+  sorted = "#{dir}/sorted.txt"
+  File.write(sorted, File.readlines(files[0]).map(&:to_i).sort.join("\n") + "\n")
+
+  cases = {
+    "load"        => [files[0]],
+    "load sorted" => [sorted],
+    "union"       => files.zip(["U"] * (FILES - 1)).flatten.compact,
+    "intersect"   => files.zip(["X"] * (FILES - 1)).flatten.compact,
+    "invert"      => ["I", "(", files[0], "U", "(", "I", files[1], ")", ")"],
+  }
+
+  threads = Etc.nprocessors
+  configs = {
+    "4K pages, 1 thread"                => ["-nohuge", "-t", "1"],
+    "huge pages, 1 thread"              => ["-t", "1"],
+    "4K pages, #{threads} threads"      => ["-nohuge", "-t", "#{threads}"],
+    "huge pages, #{threads} threads"    => ["-t", "#{threads}"],
+  }
+  configs.delete_if { |name, opts| threads == 1 && name =~ /threads/ }
+
+  puts "max id #{MAX_ID}, #{ID_COUNT} ids per file"
+  printf("%-28s", "")
+  cases.each_key { |c| printf("%12s", c) }
+  puts
+
+  configs.each do |name, opts|
+    printf("%-28s", name)
+    cases.each_value { |expr| printf("%11.3fs", time_run(opts + expr)) }
+    puts
+  end
+end
+
+exit(0)
@@ -0,0 +1,429 @@
+//
+// Checks libfilesets through the C++ wrapper against the fixtures in
+// the test dir: the operators, overlap, rank, select and sampling,
+// large loads and writes, evaluating in passes, and error codes. It
+// also checks that a caller's allocator gets everything back, and that
+// separate contexts can evaluate at once from several threads.
+//
+// Usage: fs-lib-test path_to_test_dir
+//
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <thread>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "filesets.hpp"
+
+using filesets::Context;
+using filesets::Set;
+
+static const uint32_t MAX_ID_VAL = 20;
+static int Failures = 0;
+
+static void
+fail (const std::string & what)
+{
+  std::cerr << "TEST FAILED: " << what << "\n";
+  Failures++;
+}
+
+static std::vector<uint32_t>
+fixture (const std::string & file)
+{
+  std::ifstream in (file);
+  std::vector<uint32_t> ids;
+  uint32_t id;
+
+  while (in >> id)
+    ids.push_back (id);
+  std::sort (ids.begin (), ids.end ());
+  ids.erase (std::unique (ids.begin (), ids.end ()), ids.end ());
+  return ids;
+}
+
+static void
+expect (const std::string & what, const std::vector<uint32_t> & got, const std::string & file)
+{
+  if (got != fixture (file))
+    fail (what + " != " + file);
+}
+
+static void
+expectError (const std::string & what, FsStatus status, void (* fn) (Context & ctx), uint32_t max = MAX_ID_VAL)
+{
+  Context ctx (max);
+
+  try
+  {
+    fn (ctx);
+    fail (what + ": no error");
+  }
+  catch (const filesets::Error & e)
+  {
+    if (e.status () != status)
+      fail (what + ": " + fsStatusName (e.status ()) + " (" + e.what () + ")");
+  }
+}
+
+/* An allocator that counts what is still allocated */
+static std::atomic<long> Outstanding (0);
+
+static void * countAlloc (void *, size_t size)            { Outstanding++; return malloc (size); }
+static void * countRealloc (void *, void * p, size_t size) { if ( ! p) Outstanding++; return realloc (p, size); }
+static void   countFree (void *, void * p)                 { if (p) Outstanding--; free (p); }
+
+int
+main (int argc, char * argv[])
+{
+  if (argc != 2)
+  {
+    std::cerr << "ERROR: Test requires 1 arg: path to test dir.\n";
+    return 1;
+  }
+  if (chdir (argv[1]) != 0)
+  {
+    std::cerr << "ERROR: can't chdir to " << argv[1] << "\n";
+    return 1;
+  }
+
+  /* results */
+  {
+    Context ctx (MAX_ID_VAL);
+    Set even   = Set::load (ctx, "even.txt");
+    Set odd    = Set::load (ctx, "odd.txt");
+    Set fourth = Set::load (ctx, "fourths.txt");
+
+    expect ("union",     (even | odd).ids (),          "all.txt");
+    expect ("intersect", (even & fourth).ids (),       "fourths.txt");
+    expect ("diff",      (Set::load (ctx, "all.txt") - even).ids (), "odd.txt");
+    expect ("invert",    (~even).ids (),               "odd.txt");
+    expect ("unchanged", even.ids (),                  "even.txt");
+    expect ("and-not",   (fourth & ~even).ids (),      "none.txt");
+    expect ("nand",      (~even | ~odd).ids (),        "all.txt");
+    expect ("nor",       (~even & ~odd).ids (),        "none.txt");
+    expect ("invert x2", (~~fourth).ids (),            "fourths.txt");
+    if ((~odd).count () != even.count ())
+      fail ("complement count");
+    expect ("ranges",    Set::load (ctx, "1to10.rng").ids (), "1to10.txt");
+    expect ("eval",      ctx.eval ("T 2 ( even.txt fourths.txt 11to20.txt ) X 11to20.txt").ids (), "12to20even.txt");
+
+    Set acc (ctx);
+    acc.fold ('U', { &even, &odd, &fourth });
+    if (acc.count () != MAX_ID_VAL)
+      fail ("n-ary fold");
+
+    std::vector<uint32_t> seen;
+    fourth.forEach ([&] (uint32_t id) { seen.push_back (id); });
+    expect ("forEach", seen, "fourths.txt");
+
+    std::vector<uint32_t> shuffled = even.shuffled ();
+    std::sort (shuffled.begin (), shuffled.end ());
+    expect ("shuffled", shuffled, "even.txt");
+
+    unlink ("/tmp/fs-lib-test.state");
+    filesets::Incremental inc = ctx.evalIncremental ("even.txt U twelve.txt", "/tmp/fs-lib-test.state");
+    expect ("incremental", inc.result.ids (), "even.txt");
+    expect ("incremental added", inc.added.ids (), "even.txt");
+    inc = ctx.evalIncremental ("even.txt U twelve.txt", "/tmp/fs-lib-test.state");
+    if (inc.added.count () != 0 || inc.removed.count () != 0)
+      fail ("incremental rerun changed");
+  }
+
+  /* all-pairs overlap */
+  {
+    Context ctx (MAX_ID_VAL);
+    std::vector<std::string> files = { "even.txt", "odd.txt", "fourths.txt", "1to10.rng", "11to20.txt",
+                                       "twelve.txt", "none.txt" };
+    std::vector<uint64_t> counts = ctx.threads (2).overlap (files);
+
+    for (size_t i = 0; i < files.size (); i++)
+      for (size_t j = 0; j < files.size (); j++)
+        if (counts[i * files.size () + j] != (Set::load (ctx, files[i]) & Set::load (ctx, files[j])).count ())
+          fail ("overlap " + files[i] + " X " + files[j]);
+  }
+
+  /* rank and select, in memory and from a binary set file */
+  {
+    const uint32_t max = 1000000;
+    Context ctx (max);
+    std::vector<uint32_t> ids;
+    uint64_t x = 12345;
+
+    ctx.threads (3);
+    for (uint32_t id = 1; id <= max; id++)
+    {
+      x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+      if ((x >> 33) % 7 == 0 || (id > 300000 && id < 310000))
+        ids.push_back (id);
+    }
+    Set s = Set::fromIds (ctx, ids);
+
+    FILE * fp = fopen ("/tmp/fs-lib-test.bin", "w");
+    s.write (fp, FS_FORMAT_BINARY);
+    fclose (fp);
+    if (Set::load (ctx, "/tmp/fs-lib-test.bin").ids () != ids)
+      fail ("binary load");
+
+    for (uint64_t k = 0; k < ids.size (); k += 997)
+      if (s.select (k) != ids[k] || ctx.fileSelect ("/tmp/fs-lib-test.bin", k) != ids[k])
+        fail ("select " + std::to_string (k));
+    for (uint32_t id = 0; id <= max + 1; id += 1009)
+    {
+      uint64_t r = std::lower_bound (ids.begin (), ids.end (), id) - ids.begin ();
+      if (s.rank (id) != r || ctx.fileRank ("/tmp/fs-lib-test.bin", id) != r)
+        fail ("rank " + std::to_string (id));
+    }
+    Set ends = Set::fromIds (ctx, std::vector<uint32_t> { 1, max });
+    fp = fopen ("/tmp/fs-lib-test.bin", "w");
+    ends.write (fp, FS_FORMAT_BINARY);
+    fclose (fp);
+    if (ends.select (1) != max || ctx.fileSelect ("/tmp/fs-lib-test.bin", 1) != max || ends.select (0) != 1)
+      fail ("select max");
+    expectError ("select past end", FS_ERANGE, [] (Context & ctx) { Set s (ctx); s.select (0); });
+
+    fp = tmpfile ();
+    s.writePage (fp, 250000, 400000, 100, 20000);
+    rewind (fp);
+    std::vector<uint32_t> page;
+    uint32_t id;
+    while (fscanf (fp, "%u", &id) == 1)
+      page.push_back (id);
+    fclose (fp);
+    auto from = std::lower_bound (ids.begin (), ids.end (), 250000) + 100;
+    if (page != std::vector<uint32_t> (from, from + 20000))
+      fail ("page");
+
+    /* samples are distinct members, repeatable with a seed, and split across strata by size */
+    ctx.seed (42);
+    std::vector<uint32_t> pick = s.sample (5000);
+    if (pick.size () != 5000 || std::adjacent_find (pick.begin (), pick.end (), std::greater_equal<uint32_t> ()) != pick.end () ||
+        ! std::includes (ids.begin (), ids.end (), pick.begin (), pick.end ()))
+      fail ("sample");
+    ctx.seed (42);
+    if (s.sample (5000) != pick)
+      fail ("sample seed");
+    pick = s.sample (1000, 2);
+    uint64_t low = std::lower_bound (ids.begin (), ids.end (), max / 2 + 1) - ids.begin ();
+    uint64_t got = std::lower_bound (pick.begin (), pick.end (), max / 2 + 1) - pick.begin ();
+    if (got != 1000 * low / ids.size () && got != 1000 * low / ids.size () + 1)
+      fail ("sample strata");
+
+    /* with fewer picks than strata, the rounding still reaches every stratum across seeds */
+    {
+      Context small (MAX_ID_VAL);
+      Set all = Set::load (small, "all.txt");
+      std::vector<bool> half (2), seen (MAX_ID_VAL + 1);
+      for (uint64_t seed = 1; seed <= 200; seed++)
+      {
+        small.seed (seed);
+        for (uint32_t id : all.sample (1, 2))
+          half[id > MAX_ID_VAL / 2] = true;
+        for (uint32_t id : all.sample (4, 100))
+          seen[id] = true;
+      }
+      if (! half[0] || ! half[1] || std::count (seen.begin () + 1, seen.end (), true) != MAX_ID_VAL)
+        fail ("sample small strata");
+    }
+    if (s.sample (ids.size () + 1) != ids)
+      fail ("sample all");
+
+    /* the index follows changes to the set */
+    s.invert ();
+    if (s.select (0) != 1 || s.rank (max + 1) != max - ids.size ())
+      fail ("rank after invert");
+  }
+
+  /* a file in random order, scattered by ID before it is applied when not on huge pages */
+  for (bool huge : { false, true })
+  {
+    Context ctx (20000000);
+    std::vector<uint32_t> ids;
+    uint64_t x = 777;
+
+    ctx.hugePages (huge);
+    std::ofstream out ("/tmp/fs-lib-test.txt");
+    for (int i = 0; i < 300000; i++)
+    {
+      x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+      ids.push_back ((x >> 33) % ctx.max () + 1);
+      out << ids.back () << "\n" << (i % 5 == 0 ? std::to_string (ids.back ()) + "\n" : "");
+    }
+    out.close ();
+    std::sort (ids.begin (), ids.end ());
+    ids.erase (std::unique (ids.begin (), ids.end ()), ids.end ());
+    if (Set::load (ctx, "/tmp/fs-lib-test.txt").ids () != ids)
+      fail (std::string ("unsorted load") + (huge ? "" : ", no huge pages"));
+  }
+
+  /* output many times the writer's buffers comes out whole and in order */
+  {
+    Context ctx (6000000);
+    std::vector<uint32_t> ids;
+    std::string expected[2];
+
+    /* runs of one and two */
+    for (uint32_t id = 1; id <= ctx.max (); id += (id % 7 == 0) ? 1 : 3)
+      ids.push_back (id);
+    for (size_t i = 0; i < ids.size (); i++)
+      expected[0] += std::to_string (ids[i]) + "\n";
+    for (size_t i = 0; i < ids.size (); i++)
+      if (i + 1 < ids.size () && ids[i + 1] == ids[i] + 1)
+      {
+        expected[1] += std::to_string (ids[i]) + "-" + std::to_string (ids[i + 1]) + "\n";
+        i++;
+      }
+      else
+        expected[1] += std::to_string (ids[i]) + "\n";
+
+    Set s = Set::fromIds (ctx, ids);
+    for (FsFormat format : { FS_FORMAT_IDS, FS_FORMAT_RANGES })
+    {
+      FILE      * fp = tmpfile ();
+      std::string out;
+      char        buf[65536];
+      size_t      n;
+
+      s.write (fp, format);
+      rewind (fp);
+      while ((n = fread (buf, 1, sizeof(buf), fp)) > 0)
+        out.append (buf, n);
+      fclose (fp);
+      if (out != expected[format])
+        fail ("large write, format " + std::to_string (format));
+    }
+  }
+
+  /*
+   * evaluating in passes under a memory limit writes what one pass does,
+   * also with fewer descriptors than passes
+   */
+  for (FsFormat format : { FS_FORMAT_IDS, FS_FORMAT_RANGES })
+    for (const char * expr : { "I ( /tmp/fs-lib-test.txt D 1to10.rng )",
+                               "T 2 ( /tmp/fs-lib-test.txt ( I 1to10.rng ) even.txt )" })
+    {
+      Context ctx (20000000);
+      std::string out[3];
+
+      for (int limited = 0; limited < 3; limited++)
+      {
+        FILE * fp = tmpfile ();
+        char   buf[65536];
+        size_t n;
+        struct rlimit nofile, few;
+
+        getrlimit (RLIMIT_NOFILE, &nofile);
+        few = nofile;
+        few.rlim_cur = 12;
+        if (limited == 2)
+          setrlimit (RLIMIT_NOFILE, &few);
+        ctx.memLimit (limited ? (32 << 20) >> (limited - 1) : 0).evalWrite (expr, fp, format);
+        setrlimit (RLIMIT_NOFILE, &nofile);
+        rewind (fp);
+        while ((n = fread (buf, 1, sizeof(buf), fp)) > 0)
+          out[limited].append (buf, n);
+        fclose (fp);
+      }
+      if (out[0].empty () || out[0] != out[1] || out[0] != out[2])
+        fail (std::string ("passes: ") + expr);
+    }
+
+  /* the writer keeps text, numbers and IDs in order, across buffers */
+  {
+    Context ctx (MAX_ID_VAL);
+    FsWriter * w;
+    std::string big (3 << 20, 'x'), expected, got;
+    const uint32_t ids[] = { 7, 12, 4000000000U };
+    FILE * fp = tmpfile ();
+    char   buf[65536];
+    size_t n;
+
+    filesets::check (ctx.get (), fsWriterOpen (ctx.get (), fp, &w));
+    for (int i = 0; i < 3; i++)
+    {
+      fsWriterText (w, big.c_str ());
+      fsWriterNumber (w, 18446744073709551615ULL);
+      fsWriterText (w, "\n");
+      fsWriterIds (w, ids, 3);
+      expected += big + "18446744073709551615\n7\n12\n4000000000\n";
+    }
+    filesets::check (ctx.get (), fsWriterClose (ctx.get (), w));
+    rewind (fp);
+    while ((n = fread (buf, 1, sizeof(buf), fp)) > 0)
+      got.append (buf, n);
+    fclose (fp);
+    if (got != expected)
+      fail ("writer");
+  }
+
+  /* errors */
+  expectError ("missing file", FS_EIO,     [] (Context & ctx) { Set::load (ctx, "no-such-file"); });
+  expectError ("id over max",  FS_ERANGE,  [] (Context & ctx) { Set::load (ctx, "even.txt"); }, 5);
+  expectError ("bad id",       FS_ERANGE,  [] (Context & ctx) { Set::fromIds (ctx, { 0 }); });
+  expectError ("parens",       FS_ESYNTAX, [] (Context & ctx) { ctx.eval ("( even.txt U odd.txt"); });
+  expectError ("no operator",  FS_ESYNTAX, [] (Context & ctx) { ctx.eval ("even.txt odd.txt"); });
+  expectError ("bad T",        FS_ESYNTAX, [] (Context & ctx) { ctx.eval ("T 0 ( even.txt )"); });
+  expectError ("bad fold",     FS_EINVAL,  [] (Context & ctx) { Set s (ctx); s.fold ('Q', {}); });
+  expectError ("threads",      FS_EINVAL,  [] (Context & ctx) { ctx.threads (0); });
+  expectError ("pass format",  FS_EINVAL,  [] (Context & ctx) { ctx.memLimit (4 << 20).evalWrite ("even.txt", stdout, FS_FORMAT_BINARY); }, 20000000);
+  expectError ("memory limit", FS_ENOMEM,  [] (Context & ctx) { ctx.memLimit (1).evalWrite ("even.txt", stdout); }, 20000000);
+
+  /* a caller-supplied allocator gets everything back, on failure too */
+  {
+    FsAllocator counting = { countAlloc, countRealloc, countFree, nullptr };
+    {
+      Context ctx (MAX_ID_VAL, &counting);
+      Set r = ctx.eval ("I ( ( even.txt X fourths.txt ) U T 1 ( ( odd.txt D twelve.txt ) 1to10.rng ) )");
+      for (const char * bad : { "even.txt U ( odd.txt X no-such-file )",
+                                "T 2 ( even.txt ( odd.txt U no-such-file ) )",
+                                "even.txt U ( odd.txt" })
+      {
+        try { ctx.eval (bad); fail (std::string ("no error: ") + bad); }
+        catch (const filesets::Error &) {}
+      }
+      try { ctx.overlap ({ "even.txt", "no-such-file" }); fail ("no error: overlap"); }
+      catch (const filesets::Error &) {}
+    }
+    if (Outstanding != 0)
+      fail ("allocator: " + std::to_string (Outstanding) + " allocations not freed");
+  }
+
+  /* independent contexts on several threads at once */
+  {
+    const char * exprs[][2] = {
+      { "even.txt U odd.txt",                     "all.txt" },
+      { "I ( even.txt )",                         "odd.txt" },
+      { "all.txt D even.txt",                     "odd.txt" },
+      { "T 3 ( 11to20.rng all.txt 11to20.txt )",  "11to20.txt" },
+    };
+    std::atomic<int> bad (0);
+    std::vector<std::thread> threads;
+
+    for (auto & e : exprs)
+      threads.emplace_back ([&bad, e] {
+        Context ctx (MAX_ID_VAL);
+        ctx.threads (2);
+        for (int i = 0; i < 50; i++)
+          if (ctx.eval (e[0]).ids () != fixture (e[1]))
+            bad++;
+      });
+    for (auto & t : threads)
+      t.join ();
+    if (bad != 0)
+      fail ("threads: " + std::to_string (bad) + " wrong results");
+  }
+
+  unlink ("/tmp/fs-lib-test.state");
+  unlink ("/tmp/fs-lib-test.bin");
+  unlink ("/tmp/fs-lib-test.txt");
+
+  if (Failures)
+    return 1;
+  std::cout << "Passed all library tests.\n";
+  return 0;
+}
@@ -6,13 +6,14 @@ MAX_ID_VAL = 20
 OUTFILE    = "/tmp/result.txt"
 
 def run_one_test(line)
-  result_file, *expression = line.strip.split(" ")
-  expression = expression.join(" ")
+  result_file, *args = line.strip.split(" ")
+  expression = args.join(" ")
 
   # puts "#{FileSet} -max #{MAX_ID_VAL} -o #{OUTFILE} #{expression}"
 
   # file-sets -max #{MAX_ID_VAL} -o result.txt expresion
-  r = Kernel.system(FileSet, "-max", "#{MAX_ID_VAL}", "-o", OUTFILE, "#{expression}")
+  # (options such as -f may be given ahead of the expression)
+  r = Kernel.system(FileSet, "-max", "#{MAX_ID_VAL}", "-o", OUTFILE, *args)
 
   # err exit(1) if non-zero exit val
   if r == false
@@ -39,6 +40,14 @@ def process_test_file(file)
   File.open(file) do |f|
     f.each do |line|
       next if line[0..0] == '#' || line.strip.size == 0
+      if line[0..0] == '!'
+        # a shell command to set up the next test, e.g. appending to an input
+        if Kernel.system(line[1..-1].strip) == false
+          $stderr.puts "\nTEST FAILED: could not run: #{line[1..-1].strip}\n\n"
+          exit(1)
+        end
+        next
+      end
       run_one_test(line)
       flag = true
     end
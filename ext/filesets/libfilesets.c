@@ -0,0 +1,4945 @@
+/*
+ * libfilesets: the set code behind the filesets program, callable in
+ * process. See filesets.h for the API.
+ */
+#include <assert.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <pthread.h>
+#ifdef __linux
+#include <linux/limits.h>
+#endif
+
+#include "filesets.h"
+
+#define FALSE 0
+#define TRUE  (!FALSE)
+
+typedef           int boolean;
+typedef           int int32;
+typedef unsigned  int uint32;
+typedef          long int64;
+typedef unsigned long uint64;
+
+#define STACK_CHUNK    1024   /* stack slots added each time a stack grows */
+#define NARY_BATCH       16   /* sub-expression results folded per blocked pass */
+#define BLOCK_WORDS    4096   /* 64-bit words per block (32 KB of each vector) */
+#define MAX_GENERATION  255   /* highest generation mark a vector byte can hold */
+#define MAX_THREADS    FS_MAX_THREADS
+#define ID_BATCH       4096   /* IDs parsed before they are applied to a vector */
+#define SCATTER_BATCH  (1 << 20)  /* IDs of a text file radix-scattered before they are applied */
+#define SCATTER_SHIFT    18   /* each scatter bucket covers 2^18 IDs (256 KB of a vector) */
+#define TLB_PAGES      1024   /* pages the TLB is assumed to cover */
+#define HUGE_PAGE_SIZE  (2 * 1024 * 1024)
+#define PAGE_SIZE_MIN   4096
+#define RANK_BLOCK     4096   /* IDs per rank index entry (512 words of a vector) */
+#define BITS_HEADER     128   /* bytes of text header in a binary set file */
+#define BITS_MAGIC     "filesets-bits 1\n"
+#define OVERLAP_BLOCK  1024   /* bitmap words (64K IDs) of every set per overlap tile */
+#define OVERLAP_TILE      4   /* sets on each side of an overlap micro-tile */
+#define PREFETCH_BYTES (64 << 20)  /* bytes of the next input file read ahead */
+#define WRITE_SLOTS       4   /* output buffers formatted ahead of the writer thread */
+#define WRITE_BUFFER   (1 << 20)  /* bytes per output buffer */
+#define WRITE_LINE       32   /* room for the longest output line */
+#define PARTITION_FILES 256   /* most partitions open at once while splitting the inputs */
+#define PARTITION_BUFFER (64 << 10)  /* bytes buffered per open partition */
+
+/* Build a kernel for CPUs with and without a popcount instruction, picked at load time */
+#if defined(__x86_64__) && defined(__linux) && defined(__GNUC__) && ! defined(__clang__)
+#define POPCOUNT_CLONES  __attribute__ ((target_clones ("popcnt", "default")))
+#else
+#define POPCOUNT_CLONES
+#endif
+
+/*
+ * U = Union
+ * X = Intersection
+ * D = Difference
+ * I = Inverse/Complement
+ */
+#define is_operator(c)  (c == 'U' || c == 'X' || c == 'D' || c == 'I')
+
+
+typedef enum _TokenType
+{
+  OPERATOR = 1,
+  SFILE    = 2,
+  SET      = 3
+} TokenType;
+
+typedef struct _Token {
+  TokenType type;
+  union {
+    uint64 operator;
+    char * file;
+    char * history;
+  } x;
+  struct _Token ** args;    /* operands of an OPERATOR, once exprTree() links them */
+  uint32           argCnt;
+  uint32           threshold; /* k of a T operator */
+  char * vector;
+  boolean mapped;           /* vector came from mmap() rather than the allocator */
+  boolean huge;             /* vector is on (or madvise()'d for) huge pages */
+  boolean complement;       /* vector holds the IDs 1..max not in the set (setInvert()) */
+  uint64 * rank;            /* rank index, once a query has built it (setRankBuild()) */
+} Token;
+
+typedef Token Set;
+
+/*
+ * How fileParse() applies each batch of parsed IDs to a vector. An
+ * unsorted batch is first scattered by its IDs' high bits into scatter,
+ * using buckets (bucketCnt of them) to count and place each bucket's IDs.
+ */
+typedef struct _Load {
+  void    (* fn) (struct _Load * ld, uint32 * ids, uint32 n);
+  void    (* rangeFn) (struct _Load * ld, uint32 first, uint32 last);
+  Token   * acc;
+  Token   * seen;
+  char      from, to;
+  void    * arg;            /* anything else fn needs */
+  uint32  * scatter;
+  uint32  * buckets;
+  uint32    bucketCnt;
+} Load;
+
+/*
+ * A sweep applies fn to words [lo, hi) of one or more set vectors.
+ * sweep() hands each thread its own contiguous slice.
+ */
+typedef struct _Sweep {
+  void    (* fn) (struct _Sweep * w);
+  Token   * acc;
+  Token  ** sets;
+  uint32    n;
+  char      gen;
+  void    * arg;            /* anything else fn needs */
+  uint64    lo, hi;
+} Sweep;
+
+/*
+ * A set as the rank and select queries see it: either a vector with one
+ * byte per ID, or the bit vector of a mapped binary set file (ID i is
+ * bit i % 8 of byte i / 8). Either way index has one entry per
+ * RANK_BLOCK IDs: the number of members before the block. A file's
+ * entries are little-endian; a vector's are native (Token.rank).
+ */
+typedef struct _View {
+  const char          * vector;
+  const unsigned char * bits;
+  const uint64        * rank;
+  const unsigned char * index;
+  uint32                max;
+  uint64                count;
+  void                * map;
+  uint64                mapSize;
+} View;
+
+/*
+ * All-pairs intersection counts (fsOverlap()): the sets packed as
+ * bitmaps of words 64-bit words each (bit i % 64 of word i / 64 is ID
+ * i), and the n x n counts, which each thread adds its slice to.
+ */
+typedef struct _Overlap {
+  uint64 ** bits;
+  uint32    n;
+  uint64    words;
+  uint64    vectorWords;
+  uint64  * counts;
+} Overlap;
+
+/*
+ * Items live in data[base..depth]. stackPop() takes from the top and
+ * stackShift() from the bottom, so the stack doubles as a FIFO queue.
+ */
+typedef struct _Stack {
+  int32   depth;
+  int32   base;
+  int32   size;
+  void ** data;
+} Stack;
+
+/*
+ * An input file and how much of it has been parsed, for incremental
+ * evaluation. Offsets stop at the end of the last complete line, and
+ * a last line without its newline is not parsed at all: it is still
+ * being written, and is parsed once it is finished.
+ */
+typedef struct _Input {
+  char * file;
+  uint64 offset;
+  uint64 dev;
+  uint64 ino;
+} Input;
+
+/* What fsEvalIncremental() remembers between runs */
+typedef struct _State {
+  uint32  max;
+  char  * expr;
+  Stack * inputs;
+  Token * result;
+} State;
+
+/*
+ * How a node's set changed since the last run: not at all, by gaining
+ * or losing exactly the IDs in delta, or in a way that can only be
+ * found by evaluating the node again.
+ */
+typedef enum _ChangeType
+{
+  UNCHANGED = 0,
+  ADDED     = 1,
+  REMOVED   = 2,
+  RECOMPUTE = 3
+} ChangeType;
+
+typedef struct _Change {
+  ChangeType type;
+  Token    * delta;
+} Change;
+
+/*
+ * The output end of a run, as two stages: the caller formats lines
+ * into a ring of buffers, and a writer thread writes the full ones to
+ * fp in order, so output I/O overlaps formatting (and, during passes,
+ * the next pass's loading and evaluation). The ring bounds how far the
+ * caller gets ahead; it waits for the writer when every buffer is full.
+ * Without the thread, each buffer is written when it fills.
+ */
+typedef struct _Writer {
+  FILE          * fp;
+  char          * buf[WRITE_SLOTS];
+  uint64          len[WRITE_SLOTS];
+  uint64          filled, written;    /* buffers handed to the writer, and written by it */
+  char          * pos, * end;         /* the buffer being filled; end leaves WRITE_LINE bytes */
+  boolean         threaded;
+  boolean         closing;
+  pthread_t       thread;
+  pthread_mutex_t lock;
+  pthread_cond_t  cond;
+} Writer;
+
+/*
+ * Where fsEvalWrite() is in a run of passes over ranges of IDs. Each
+ * pass evaluates with max set to the size of its range, so the IDs it
+ * writes are offset by base. The last run written with ranges is held
+ * back in case the next pass carries it on. One writer takes every
+ * pass's output.
+ */
+typedef struct _Pass {
+  uint64     base;
+  uint64     runFirst, runLast;   /* runLast is 0 when no run is held */
+  Writer   * writer;
+} Pass;
+
+/*
+ * The input files of fsEvalWrite(), split into one file per pass. Only
+ * the partitions of passes first to first + cnt - 1 are open at once;
+ * IDs of other passes are left for another read. Lines are formatted
+ * into a buffer of PARTITION_BUFFER bytes per open partition.
+ */
+typedef struct _Partition {
+  int      * fds;
+  char     * buf;
+  uint32   * len;           /* bytes in each partition's buffer */
+  uint64     span;          /* IDs per pass */
+  uint64     first, cnt;
+  boolean    failed;        /* a write to a partition failed */
+} Partition;
+
+/*
+ * Everything that used to be global. Only status and message change
+ * during a call (and inputs, during fsEvalIncremental()), which is why
+ * a context is used by one thread at a time.
+ */
+struct _FsContext {
+  uint32       max;
+  uint32       threads;
+  boolean      hugePages;
+  boolean      verbose;
+  FsAllocator  alloc;
+  boolean      customAlloc;
+  boolean      reported;      /* the kind of vector allocation has been logged */
+  uint64       rng;
+  boolean      seeded;
+  Stack      * inputs;        /* files parsed this call, recorded only for incremental runs */
+  uint64       memLimit;      /* bytes of set vectors fsEvalWrite() may use at once; 0 for no limit */
+  Pass       * pass;          /* the pass fsEvalWrite() is on, if it's taking several */
+  FsStatus     status;
+  char         message[1024];
+};
+
+/*
+ * The format stage of fsEvalWrite() passes: a thread that writes one
+ * pass's result to the writer while the next pass loads and evaluates.
+ * It works in its own copy of the context, with max and the pass as
+ * they were for that result, since the caller's move on to the next.
+ */
+typedef struct _Stage {
+  FsContext   ctx;
+  Set       * s;            /* the result being written, NULL when there is none */
+  FILE      * fp;
+  FsFormat    format;
+  FsStatus    status;
+  pthread_t   thread;
+  boolean     threaded;
+} Stage;
+
+/* -------------------------------------------------------------------- */
+
+/*
+ * Record why a call failed, for fsErrorMessage(), and return status
+ * so that failures can be passed straight up.
+ */
+static FsStatus fsFail (FsContext * ctx, FsStatus status, const char * fmt, ...)
+  __attribute__ ((format (printf, 3, 4)));
+
+static FsStatus
+fsFail (FsContext * ctx, FsStatus status, const char * fmt, ...)
+{
+  va_list ap;
+
+  va_start (ap, fmt);
+  vsnprintf (ctx->message, sizeof(ctx->message), fmt, ap);
+  va_end (ap);
+  ctx->status = status;
+
+  return (status);
+}
+
+static void *
+defaultAlloc (void * arg, size_t size)
+{
+  return (malloc (size));
+}
+
+static void *
+defaultRealloc (void * arg, void * p, size_t size)
+{
+  return (realloc (p, size));
+}
+
+static void
+defaultFree (void * arg, void * p)
+{
+  free (p);
+}
+
+static void *
+ctxAlloc (FsContext * ctx, size_t size)
+{
+  void * p;
+
+  if ((p = ctx->alloc.alloc (ctx->alloc.arg, size)) == NULL)
+    fsFail (ctx, FS_ENOMEM, "can't allocate %lu bytes", size);
+  return (p);
+}
+
+static void *
+ctxRealloc (FsContext * ctx, void * p, size_t size)
+{
+  void * q;
+
+  if ((q = ctx->alloc.realloc (ctx->alloc.arg, p, size)) == NULL)
+    fsFail (ctx, FS_ENOMEM, "can't reallocate %lu bytes", size);
+  return (q);
+}
+
+static void
+ctxFree (FsContext * ctx, void * p)
+{
+  if (p)
+    ctx->alloc.free (ctx->alloc.arg, p);
+}
+
+static char *
+ctxStrdup (FsContext * ctx, const char * str)
+{
+  char * p;
+
+  if ((p = ctxAlloc (ctx, strlen(str) + 1)) != NULL)
+    strcpy (p, str);
+  return (p);
+}
+
+/*
+ * Random numbers for shuffling (splitmix64), kept in the context
+ * rather than in random()'s global state. Unless fsContextSeed() was
+ * called the generator is seeded from /dev/urandom on first use.
+ */
+static uint64
+rngNext (FsContext * ctx)
+{
+  FILE * fp;
+  uint64 z;
+
+  if ( ! ctx->seeded)
+  {
+    ctx->rng = (uint64) time (NULL) ^ ((uint64) getpid() << 32);
+    if ((fp = fopen ("/dev/urandom", "r")) != NULL)
+    {
+      if (fread (&z, sizeof(z), 1, fp) == 1)
+        ctx->rng = z;
+      fclose (fp);
+    }
+    ctx->seeded = TRUE;
+  }
+
+  z = (ctx->rng += 0x9E3779B97F4A7C15UL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9UL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBUL;
+  return (z ^ (z >> 31));
+}
+
+/*
+ * A random integer in [0, n), n > 0, without the bias of rngNext() % n:
+ * Lemire's multiply-shift takes the high word of rngNext() * n, and
+ * redraws the few values whose low word would make some results more
+ * likely than others.
+ */
+static uint64
+rngBelow (FsContext * ctx, uint64 n)
+{
+  unsigned __int128 m = (unsigned __int128) rngNext (ctx) * n;
+  uint64            threshold;
+
+  if ((uint64) m < n)
+  {
+    threshold = -n % n;
+    while ((uint64) m < threshold)
+      m = (unsigned __int128) rngNext (ctx) * n;
+  }
+  return ((uint64) (m >> 64));
+}
+
+static Token *
+tokenNew (FsContext * ctx)
+{
+  Token * t;
+
+  if ((t = ctxAlloc (ctx, sizeof(Token))) != NULL)
+    memset(t, 0, sizeof(Token));
+  return (t);
+}
+
+static void
+tokenFree (FsContext * ctx, Token * t)
+{
+  if (t->type != OPERATOR)
+    ctxFree(ctx, t->x.history);
+  ctxFree(ctx, t->args);
+  ctxFree(ctx, t);
+}
+
+static void setFree (FsContext * ctx, Set * s);
+
+/* Free t and everything below it */
+static void
+tokenTreeFree (FsContext * ctx, Token * t)
+{
+  uint32 i;
+
+  if (t == NULL)
+    return;
+
+  if (t->type == OPERATOR && t->args != NULL)
+    for (i = 0; i < t->argCnt; i++)
+      tokenTreeFree (ctx, t->args[i]);
+
+  if (t->vector != NULL)
+    setFree (ctx, t);
+  else
+    tokenFree (ctx, t);
+}
+
+/* whole 64-bit words in a set vector; the remaining bytes are swept one at a time */
+static uint64
+vectorWords (FsContext * ctx)
+{
+  return (((uint64) ctx->max + 1) / sizeof(uint64));
+}
+
+static void *
+sweepThread (void * arg)
+{
+  Sweep * w = arg;
+
+  w->fn (w);
+  return (NULL);
+}
+
+/*
+ * Run w->fn over every whole 64-bit word of a set vector, split into
+ * one contiguous slice per thread (fsContextThreads()). Slices are
+ * aligned to huge pages so that no page is shared between threads;
+ * since each thread also first-touches its own slice (vectorAlloc()),
+ * the pages end up on the NUMA node of the thread that sweeps them.
+ */
+static void
+sweep (FsContext * ctx, Sweep * w)
+{
+  Sweep     part[MAX_THREADS];
+  pthread_t tid[MAX_THREADS];
+  uint64    nWords, chunk, align;
+  uint32    i;
+
+  nWords = vectorWords(ctx);
+  align  = HUGE_PAGE_SIZE / sizeof(uint64);
+  chunk  = ((nWords + ctx->threads - 1) / ctx->threads + align - 1) / align * align;
+
+  if (ctx->threads == 1 || chunk >= nWords)
+  {
+    w->lo = 0;
+    w->hi = nWords;
+    w->fn (w);
+    return;
+  }
+
+  for (i = 0; i < ctx->threads; i++)
+  {
+    part[i]    = *w;
+    part[i].lo = (i * chunk < nWords) ? i * chunk : nWords;
+    part[i].hi = ((i + 1) * chunk < nWords) ? (i + 1) * chunk : nWords;
+    if (pthread_create (&tid[i], NULL, sweepThread, &part[i]) != 0)
+    {
+      /* no thread to be had; do this slice here */
+      sweepThread (&part[i]);
+      tid[i] = 0;
+    }
+  }
+
+  for (i = 0; i < ctx->threads; i++)
+    if (tid[i])
+      pthread_join (tid[i], NULL);
+}
+
+static void
+touchWords (Sweep * w)
+{
+  uint64 i;
+
+  for (i = w->lo * sizeof(uint64); i < w->hi * sizeof(uint64); i += PAGE_SIZE_MIN)
+    w->acc->vector[i] = 0;
+}
+
+/* Zero the slice of an allocated vector, first touching its pages from this thread */
+static void
+zeroWords (Sweep * w)
+{
+  memset (w->acc->vector + w->lo * sizeof(uint64), 0, (w->hi - w->lo) * sizeof(uint64));
+}
+
+static uint64
+vectorBytes (FsContext * ctx)
+{
+  return (((uint64) ctx->max + 1 + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE);
+}
+
+/* Whether vectorAlloc() tries to map vectors: only for a huge page or more */
+static boolean
+vectorMapped (FsContext * ctx)
+{
+  return (ctx->hugePages && ! ctx->customAlloc && (uint64) ctx->max + 1 >= HUGE_PAGE_SIZE);
+}
+
+/* The bytes vectorAlloc() takes per vector: whole huge pages if mapped, else just max + 1 */
+static uint64
+vectorSize (FsContext * ctx)
+{
+  return (vectorMapped (ctx) ? vectorBytes (ctx) : (uint64) ctx->max + 1);
+}
+
+/*
+ * Allocate a zeroed vector for s. Vectors are gigabytes at large max
+ * IDs, so they are backed by huge pages where possible to cut TLB
+ * misses: first explicit huge pages (MAP_HUGETLB, which needs pages
+ * reserved in /proc/sys/vm/nr_hugepages), then transparent huge pages
+ * via madvise(), then the allocator. A vector smaller than a huge page
+ * comes from the allocator, at its own size. Anonymous mappings come
+ * back zeroed; an allocated vector is zeroed by a sweep instead, so
+ * either way each thread's slice is first touched by that thread. A
+ * caller-supplied allocator is always used as is.
+ */
+static FsStatus
+vectorAlloc (FsContext * ctx, Set * s)
+{
+  const char * how     = "malloc()";
+  Sweep        w;
+  char       * v       = MAP_FAILED;
+  uint64       size    = vectorBytes(ctx);
+  boolean      huge    = FALSE;
+
+  if (vectorMapped (ctx))
+  {
+#ifdef MAP_HUGETLB
+    v = mmap (NULL, size, PROT_READ | PROT_WRITE,
+              MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    how = "huge pages (MAP_HUGETLB)";
+    huge = TRUE;
+#endif
+    if (v == MAP_FAILED)
+    {
+      v = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      how = "mmap()";
+      huge = FALSE;
+#ifdef MADV_HUGEPAGE
+      if (v != MAP_FAILED && madvise (v, size, MADV_HUGEPAGE) == 0)
+      {
+        how = "transparent huge pages (madvise)";
+        huge = TRUE;
+      }
+#endif
+    }
+  }
+
+  if (v != MAP_FAILED)
+  {
+    s->vector = v;
+    s->mapped = TRUE;
+    s->huge   = huge;
+
+    /* Place each slice of the vector on the node of the thread that will sweep it. */
+    if (ctx->threads > 1)
+    {
+      memset(&w, 0, sizeof(w));
+      w.fn  = touchWords;
+      w.acc = s;
+      sweep (ctx, &w);
+    }
+  }
+  else
+  {
+    how = ctx->customAlloc ? "the caller's allocator" : "malloc()";
+    s->vector = ctxAlloc (ctx, (uint64) ctx->max + 1);
+    if (s->vector == NULL)
+      return (ctx->status);
+    s->mapped = FALSE;
+    s->huge   = FALSE;
+
+    memset(&w, 0, sizeof(w));
+    w.fn  = zeroWords;
+    w.acc = s;
+    sweep (ctx, &w);
+    memset(s->vector + vectorWords(ctx) * sizeof(uint64), 0, ((uint64) ctx->max + 1) % sizeof(uint64));
+  }
+
+  if (ctx->verbose && ! ctx->reported)
+    fprintf (stderr, "set vectors: %s\n", how);
+  ctx->reported = TRUE;
+
+  return (FS_OK);
+}
+
+static void
+vectorFree (FsContext * ctx, Set * s)
+{
+  if (s->mapped)
+    munmap (s->vector, vectorBytes(ctx));
+  else
+    ctxFree(ctx, s->vector);
+  s->vector = NULL;
+}
+
+/* A new, empty set; NULL if it can't be allocated */
+static Set *
+setNew (FsContext * ctx)
+{
+  Set * s;
+
+  if ((s = (Set *) tokenNew(ctx)) == NULL)
+    return (NULL);
+  if (vectorAlloc(ctx, s) != FS_OK)
+  {
+    tokenFree(ctx, s);
+    return (NULL);
+  }
+  s->type = SET;
+  return (s);
+}
+
+static void
+setFree (FsContext * ctx, Set * s)
+{
+  vectorFree(ctx, s);
+  ctxFree(ctx, s->rank);
+  tokenFree(ctx, (Token *) s);
+}
+
+static FsStatus inputNote (FsContext * ctx, const char * file, uint64 offset, struct stat * statBuf);
+
+/* bytes of bit vector in a binary set file, padded to whole words */
+static uint64
+bitsBytes (uint32 max)
+{
+  return (((uint64) max / 8 + 1 + sizeof(uint64) - 1) / sizeof(uint64) * sizeof(uint64));
+}
+
+static boolean
+bitsIs (const char * base, uint64 size)
+{
+  return (size >= BITS_HEADER && memcmp (base, BITS_MAGIC, strlen(BITS_MAGIC)) == 0);
+}
+
+/*
+ * Check the header of the binary set file mapped at base and point v
+ * at its index and bit vector. Format (setWriteBinary()):
+ *
+ *   filesets-bits 1
+ *   max <max id>
+ *   count <ids>
+ *   block <ids per index entry>
+ *   (newlines up to BITS_HEADER bytes)
+ *   index: max / block + 1 little-endian uint64 entries
+ *   bits:  max + 1 bits, padded to a multiple of 8 bytes
+ */
+static FsStatus
+bitsHeader (FsContext * ctx, const char * file, const char * base, uint64 size, View * v)
+{
+  char   header[BITS_HEADER + 1];
+  uint32 block;
+
+  memcpy (header, base, BITS_HEADER);
+  header[BITS_HEADER] = '\0';
+
+  memset(v, 0, sizeof(*v));
+  if (sscanf (header, BITS_MAGIC "max %u\ncount %lu\nblock %u\n", &v->max, &v->count, &block) != 3 ||
+      block != RANK_BLOCK ||
+      size < BITS_HEADER + ((uint64) v->max / RANK_BLOCK + 1) * sizeof(uint64) + bitsBytes(v->max))
+    return (fsFail (ctx, FS_EIO, "%s: not a valid binary set file", file));
+
+  if (v->max > ctx->max)
+    return (fsFail (ctx, FS_ERANGE, "%s: written with max ID %u, greater than the max ID (%u)",
+                    file, v->max, ctx->max));
+
+  v->index = (const unsigned char *) base + BITS_HEADER;
+  v->bits  = v->index + ((uint64) v->max / RANK_BLOCK + 1) * sizeof(uint64);
+
+  return (FS_OK);
+}
+
+/*
+ * Hand the members of the binary set file mapped at base to ld->fn, a
+ * batch at a time, skipping empty words of the bit vector whole.
+ */
+static FsStatus
+bitsParse (FsContext * ctx, Load * ld, const char * file, const char * base, uint64 size)
+{
+  View     v;
+  uint64   i, w, id;
+  uint32   ids[ID_BATCH];
+  uint32   idCnt = 0;
+  int      b;
+  FsStatus status;
+
+  if ((status = bitsHeader (ctx, file, base, size, &v)) != FS_OK)
+    return (status);
+
+  for (i = 0; i < bitsBytes(v.max); i += sizeof(uint64))
+  {
+    memcpy (&w, v.bits + i, sizeof(uint64));
+    if (w == 0)
+      continue;
+    for (b = 0; b < 64; b++)
+    {
+      id = i * 8 + b;
+      if ( ! ((v.bits[id / 8] >> (id % 8)) & 1) || id == 0 || id > v.max)
+        continue;
+      ids[idCnt++] = id;
+      if (idCnt == ID_BATCH)
+      {
+        ld->fn (ld, ids, idCnt);
+        idCnt = 0;
+      }
+    }
+  }
+  if (idCnt > 0)
+    ld->fn (ld, ids, idCnt);
+
+  return (FS_OK);
+}
+
+/*
+ * Whether IDs loaded into s are worth scattering first: only when its
+ * vector spans more pages than the TLB holds. Huge pages cover 2 GB of
+ * IDs that way, and there the extra pass over each batch costs more
+ * than the misses it saves.
+ */
+static boolean
+loadScatter (FsContext * ctx, Set * s)
+{
+  return (vectorBytes(ctx) / (s->huge ? HUGE_PAGE_SIZE : PAGE_SIZE_MIN) > TLB_PAGES);
+}
+
+/*
+ * Hand a batch of parsed IDs to ld->fn. In a randomly ordered file
+ * each ID lands on its own page of the vector, and with 4 KB pages
+ * nearly every one misses the TLB, so the batch is first radix-scattered
+ * by its IDs' high bits: a counting pass, then each ID is copied to its
+ * bucket, and ld->fn gets the IDs a 256 KB window of the vector at a
+ * time. Applying an ID is the same whatever order it comes in. A batch
+ * that is already in order skips the scatter, as does a vector the TLB
+ * covers (bucketCnt is 1; see loadScatter()).
+ */
+static void
+loadIds (Load * ld, uint32 * ids, uint32 n)
+{
+  uint32 * pos = ld->buckets;
+  uint32   i, b, sum, cnt;
+
+  for (i = 1; i < n && ids[i - 1] <= ids[i]; i++)
+    ;
+  if (i >= n || ld->bucketCnt <= 1)
+  {
+    ld->fn (ld, ids, n);
+    return;
+  }
+
+  memset (pos, 0, ld->bucketCnt * sizeof(uint32));
+  for (i = 0; i < n; i++)
+    pos[ids[i] >> SCATTER_SHIFT]++;
+  for (b = 0, sum = 0; b < ld->bucketCnt; b++)
+  {
+    cnt    = pos[b];
+    pos[b] = sum;
+    sum   += cnt;
+  }
+  for (i = 0; i < n; i++)
+    ld->scatter[pos[ids[i] >> SCATTER_SHIFT]++] = ids[i];
+
+  ld->fn (ld, ld->scatter, n);
+}
+
+/*
+ * strtol() for the start of a line. A plain run of digits is converted
+ * inline, which is several times faster than strtol() and, unlike it,
+ * as fast for IDs in random order as in sorted order. Anything else (a
+ * sign, a space, an empty line or over 10 digits) goes to strtol().
+ */
+static unsigned long
+parseId (char * line, char ** end)
+{
+  unsigned long id = 0;
+  char        * p = line;
+
+  while (p < line + 10 && (unsigned) (*p - '0') < 10)
+    id = id * 10 + (*p++ - '0');
+  if (p == line || (unsigned) (*p - '0') < 10)
+    return (strtol (line, end, 10));
+  *end = p;
+  return (id);
+}
+
+/*
+ * Parse the IDs in file, starting at byte offset, handing them to
+ * ld->fn a batch at a time (see loadIds()). A line "first-last" is a
+ * range of IDs and goes to ld->rangeFn in one call. A binary set
+ * file (-b) is recognized by its header and read with bitsParse()
+ * instead. For incremental runs, an unfinished last line is left for
+ * the next run, and the offset just past the last complete line is
+ * noted with inputNote().
+ */
+static FsStatus
+fileParse (FsContext * ctx, Load * ld, const char * file, uint64 offset)
+{
+  int         fd;
+  struct stat statBuf;
+  char      * srcBase, * srcCurr, * srcEnd, * dstPtr;
+  char        line[1024];
+  char      * idEnd;
+  unsigned long  id, idLast;
+  uint64      base, end = offset;
+  uint32    * ids;
+  uint32      idCnt = 0, batch;
+  FsStatus    status = FS_OK;
+
+  /* open the input file */
+  if ((fd = open (file, O_RDONLY)) < 0)
+    return (fsFail (ctx, FS_EIO, "can't open %s for reading", file));
+
+  /* find size of input file */
+  if (fstat (fd, &statBuf) < 0)
+  {
+    close(fd);
+    return (fsFail (ctx, FS_EIO, "can't fstat %s", file));
+  }
+
+  /* mmap() fails if the file is empty (zero bytes),
+   * so check if the file is empty before mmap()'ing it.
+   * If the file is empty, then a empty set is returned.
+   */
+  if (statBuf.st_size > (off_t) offset)
+  {
+    /* mmap the input file from the page holding offset */
+    base    = offset / sysconf(_SC_PAGESIZE) * sysconf(_SC_PAGESIZE);
+    srcBase = mmap (0, statBuf.st_size - base, PROT_READ,  MAP_SHARED, fd, base);
+    if (srcBase == (char *) -1)
+    {
+      close(fd);
+      return (fsFail (ctx, FS_EIO, "can't mmap %s", file));
+    }
+
+    madvise (srcBase, statBuf.st_size - base, MADV_SEQUENTIAL);
+    srcCurr = srcBase + (offset - base);
+    srcEnd  = srcBase + (statBuf.st_size - base);
+
+    if (offset == 0 && bitsIs (srcBase, statBuf.st_size))
+    {
+      status  = bitsParse (ctx, ld, file, srcBase, statBuf.st_size);
+      end     = statBuf.st_size;
+      srcCurr = srcEnd;     /* nothing left for the text parse below */
+    }
+
+    /* an ID takes at least two bytes of the file, so small files get small batches */
+    batch = (srcEnd - srcCurr) / 2 + 1 < SCATTER_BATCH ? (srcEnd - srcCurr) / 2 + 1 : SCATTER_BATCH;
+    ld->bucketCnt = (ld->acc != NULL && loadScatter (ctx, ld->acc)) ? (ctx->max >> SCATTER_SHIFT) + 1 : 1;
+    if ((ids = ctxAlloc (ctx, sizeof(uint32) * (2 * (uint64) batch + ld->bucketCnt))) == NULL)
+    {
+      munmap(srcBase, statBuf.st_size - base);
+      close(fd);
+      return (ctx->status);
+    }
+    ld->scatter = ids + batch;
+    ld->buckets = ld->scatter + batch;
+
+    /*
+     * The following block of commented code is equivalent to the
+     * uncommented code just after. The difference is that the
+     * code above mmap()'ed the file and it can now be treated
+     * as one big memory block. The mmap()'ed code is faster
+     * because the file data is minimally copied and no
+     * buffering is performed, which would be wasted. However,
+     * the faster code is doing a bunch of pointer manipulation
+     * which may appear to be rather confusing.
+     *
+     * while (fgets (line, 1024, fp)) {
+     *  id = strtol (line, NULL, 10);
+     *  table[id] = 1;
+     * }
+     *
+     */
+    while (srcCurr < srcEnd)
+    {
+      /* Copy one line (the last one may lack a newline) */
+      dstPtr = line;
+      while (srcCurr < srcEnd && *srcCurr != '\n')
+      {
+        if (dstPtr < line + sizeof(line) - 1)
+          *dstPtr++ = *srcCurr;
+        srcCurr++;
+      }
+      if (srcCurr++ < srcEnd)
+        end = base + (srcCurr - srcBase);
+      else if (ctx->inputs)
+        break;        /* still being written; parsed once it is finished */
+      *dstPtr = '\0';
+
+      id = parseId(line, &idEnd);
+
+      if (id > ctx->max)
+      {
+        status = fsFail (ctx, FS_ERANGE, "%s: %s is greater than the max ID (%u)", file, line, ctx->max);
+        break;
+      }
+
+      if (*idEnd == '-' && isdigit(idEnd[1]))
+      {
+        idLast = parseId(idEnd + 1, &idEnd);
+        if (idLast > ctx->max)
+        {
+          status = fsFail (ctx, FS_ERANGE, "%s: %s is greater than the max ID (%u)", file, line, ctx->max);
+          break;
+        }
+        if (id == 0)
+          id = 1;
+        if (id <= idLast)
+          ld->rangeFn (ld, id, idLast);
+        continue;
+      }
+
+      if (id != LONG_MIN && id != LONG_MAX && id != 0)
+      {
+        ids[idCnt++] = id;
+        if (idCnt == batch)
+        {
+          loadIds (ld, ids, idCnt);
+          idCnt = 0;
+        }
+      }
+    }
+
+    if (status == FS_OK && idCnt > 0)
+      loadIds (ld, ids, idCnt);
+
+    ctxFree (ctx, ids);
+    munmap(srcBase, statBuf.st_size - base);
+  }
+  close(fd);
+
+  if (status == FS_OK && ctx->inputs)
+    status = inputNote (ctx, file, end, &statBuf);
+
+  return (status);
+}
+
+static void
+markIds (Load * ld, uint32 * ids, uint32 n)
+{
+  char * v = ld->acc->vector;
+  uint32 i;
+
+  for (i = 0; i < n; i++)
+    if (v[ids[i]] == ld->from)
+      v[ids[i]] = ld->to;
+}
+
+/*
+ * Mark a whole range of IDs. Plain loads, unions and differences are
+ * a memset(); only generation marks need to look at each byte.
+ */
+static void
+markRange (Load * ld, uint32 first, uint32 last)
+{
+  char * v = ld->acc->vector;
+  uint64 i;
+
+  if (ld->from == 0 && ld->to == 1)
+    memset (v + first, 1, (uint64) last - first + 1);
+  else if (ld->from == 1 && ld->to == 0)
+    memset (v + first, 0, (uint64) last - first + 1);
+  else
+    for (i = first; i <= last; i++)
+      if (v[i] == ld->from)
+        v[i] = ld->to;
+}
+
+/*
+ * Parse the IDs in file, starting at byte offset, and fold them straight
+ * into s->vector: every ID whose byte currently holds 'from' is changed
+ * to 'to'. A plain load or a union is 0 -> 1, a difference is 1 -> 0 and
+ * an intersection advances a generation mark (see setCombine()), so a
+ * file is combined with the accumulator while it is being parsed and
+ * never needs a vector of its own.
+ */
+static FsStatus
+setReadMark (FsContext * ctx, Set * s, const char * file, uint64 offset, char from, char to)
+{
+  Load ld;
+
+  memset(&ld, 0, sizeof(ld));
+  ld.fn      = markIds;
+  ld.rangeFn = markRange;
+  ld.acc     = s;
+  ld.from = from;
+  ld.to   = to;
+
+  return (fileParse (ctx, &ld, file, offset));
+}
+
+static void countIds (Load * ld, uint32 * ids, uint32 n);
+
+static void
+countRange (Load * ld, uint32 first, uint32 last)
+{
+  uint32 ids[ID_BATCH];
+  uint64 i;
+  uint32 n = 0;
+
+  for (i = first; i <= last; i++)
+  {
+    ids[n++] = i;
+    if (n == ID_BATCH)
+    {
+      countIds (ld, ids, n);
+      n = 0;
+    }
+  }
+  countIds (ld, ids, n);
+}
+
+/*
+ * Add one to the counter of each ID the first time a file names it:
+ * seen holds, per ID, the tag (from) of the last file that counted it.
+ * Counters stop at to.
+ */
+static void
+countIds (Load * ld, uint32 * ids, uint32 n)
+{
+  unsigned char * c = (unsigned char *) ld->acc->vector;
+  char          * seen = ld->seen->vector;
+  uint32 i;
+
+  for (i = 0; i < n; i++)
+    if (seen[ids[i]] != ld->from)
+    {
+      seen[ids[i]] = ld->from;
+      if (c[ids[i]] < (unsigned char) ld->to)
+        c[ids[i]]++;
+    }
+}
+
+/* Load the file token s in place, turning it into a set */
+static FsStatus
+setRead (FsContext * ctx, Set * s)
+{
+  FsStatus status;
+
+  if (s->vector == NULL && (status = vectorAlloc(ctx, s)) != FS_OK)
+    return (status);
+
+  if ((status = setReadMark(ctx, s, s->x.file, 0, 0, 1)) != FS_OK)
+    return (status);
+
+  s->type = SET;
+
+  return (FS_OK);
+}
+
+static FsStatus
+writeStatus (FsContext * ctx, FILE * fp)
+{
+  if (ferror (fp))
+    return (fsFail (ctx, FS_EIO, "error writing output"));
+  return (FS_OK);
+}
+
+static void *
+writerThread (void * arg)
+{
+  Writer * w = arg;
+  uint64   slot;
+
+  pthread_mutex_lock (&w->lock);
+  for (;;)
+  {
+    while (w->written == w->filled && ! w->closing)
+      pthread_cond_wait (&w->cond, &w->lock);
+    if (w->written == w->filled)
+      break;
+    slot = w->written % WRITE_SLOTS;
+    pthread_mutex_unlock (&w->lock);
+
+    fwrite (w->buf[slot], 1, w->len[slot], w->fp);
+
+    pthread_mutex_lock (&w->lock);
+    w->written++;
+    pthread_cond_broadcast (&w->cond);
+  }
+  pthread_mutex_unlock (&w->lock);
+
+  return (NULL);
+}
+
+static FsStatus
+writerOpen (FsContext * ctx, FILE * fp, Writer * w)
+{
+  uint32 i;
+
+  memset(w, 0, sizeof(Writer));
+  w->fp = fp;
+  for (i = 0; i < WRITE_SLOTS; i++)
+    if ((w->buf[i] = ctxAlloc (ctx, WRITE_BUFFER)) == NULL)
+    {
+      while (i > 0)
+        ctxFree (ctx, w->buf[--i]);
+      return (ctx->status);
+    }
+  w->pos = w->buf[0];
+  w->end = w->buf[0] + WRITE_BUFFER - WRITE_LINE;
+
+  pthread_mutex_init (&w->lock, NULL);
+  pthread_cond_init (&w->cond, NULL);
+  w->threaded = (pthread_create (&w->thread, NULL, writerThread, w) == 0);
+
+  return (FS_OK);
+}
+
+/* Hand the buffer being filled to the writer, and wait for a free one */
+static void
+writerFlush (Writer * w)
+{
+  uint64 slot = w->filled % WRITE_SLOTS;
+
+  w->len[slot] = w->pos - w->buf[slot];
+  if ( ! w->threaded)
+  {
+    fwrite (w->buf[slot], 1, w->len[slot], w->fp);
+    w->pos = w->buf[slot];
+    return;
+  }
+
+  pthread_mutex_lock (&w->lock);
+  w->filled++;
+  pthread_cond_broadcast (&w->cond);
+  while (w->filled - w->written >= WRITE_SLOTS)
+    pthread_cond_wait (&w->cond, &w->lock);
+  pthread_mutex_unlock (&w->lock);
+
+  slot   = w->filled % WRITE_SLOTS;
+  w->pos = w->buf[slot];
+  w->end = w->buf[slot] + WRITE_BUFFER - WRITE_LINE;
+}
+
+/* Write what is left, stop the writer and check the output for errors */
+static FsStatus
+writerClose (FsContext * ctx, Writer * w)
+{
+  uint32 i;
+
+  if (w->pos > w->buf[w->filled % WRITE_SLOTS])
+    writerFlush (w);
+  if (w->threaded)
+  {
+    pthread_mutex_lock (&w->lock);
+    w->closing = TRUE;
+    pthread_cond_broadcast (&w->cond);
+    pthread_mutex_unlock (&w->lock);
+    pthread_join (w->thread, NULL);
+  }
+  pthread_cond_destroy (&w->cond);
+  pthread_mutex_destroy (&w->lock);
+  for (i = 0; i < WRITE_SLOTS; i++)
+    ctxFree (ctx, w->buf[i]);
+
+  return (writeStatus (ctx, w->fp));
+}
+
+/* Format id in decimal at p, several times faster than printf(); returns the end */
+static char *
+idFormat (char * p, uint64 id)
+{
+  char   digits[20];
+  uint32 n = 0;
+
+  do
+    digits[n++] = '0' + id % 10;
+  while ((id /= 10) > 0);
+  while (n > 0)
+    *p++ = digits[--n];
+
+  return (p);
+}
+
+/* Write the line "id", prefixed with prefix unless it is 0 */
+static void
+writerId (Writer * w, char prefix, uint64 id)
+{
+  if (w->pos > w->end)
+    writerFlush (w);
+  if (prefix)
+    *w->pos++ = prefix;
+  w->pos    = idFormat (w->pos, id);
+  *w->pos++ = '\n';
+}
+
+/* Write the line "first-last", or just "first" for a run of one */
+static void
+writerRange (Writer * w, uint64 first, uint64 last)
+{
+  if (w->pos > w->end)
+    writerFlush (w);
+  w->pos = idFormat (w->pos, first);
+  if (first != last)
+  {
+    *w->pos++ = '-';
+    w->pos    = idFormat (w->pos, last);
+  }
+  *w->pos++ = '\n';
+}
+
+/* Write n bytes from p, across as many buffers as they take */
+static void
+writerBytes (Writer * w, const void * p, uint64 n)
+{
+  uint64 room;
+
+  while (n > 0)
+  {
+    if (w->pos > w->end)
+      writerFlush (w);
+    room = (w->end + WRITE_LINE - w->pos < n) ? (uint64) (w->end + WRITE_LINE - w->pos) : n;
+    memcpy (w->pos, p, room);
+    w->pos += room;
+    p       = (const char *) p + room;
+    n      -= room;
+  }
+}
+
+/*
+ * Write the IDs in the set, each prefixed with prefix unless it is 0.
+ * Zero words of the vector are skipped whole.
+ */
+static void
+setWrite (FsContext * ctx, Set * s, Writer * w, char prefix)
+{
+  uint64 * words = (uint64 *) s->vector;
+  uint64   nWords = vectorWords(ctx);
+  uint64   base = ctx->pass ? ctx->pass->base : 0;
+  uint64   id;
+
+  for (id = 1; id <= ctx->max; id++)
+  {
+    if (id % sizeof(uint64) == 0 && id / sizeof(uint64) < nWords && words[id / sizeof(uint64)] == 0)
+      id += sizeof(uint64) - 1;
+    else if (s->vector[id])
+      writerId (w, prefix, id + base);
+  }
+}
+
+/*
+ * Write the run first-last of this pass's IDs. During passes, each run
+ * is held until the next one shows it can't be carried on (only one
+ * that ends a pass can be), and fsEvalWrite() writes the last.
+ */
+static void
+runWrite (FsContext * ctx, Writer * w, uint64 first, uint64 last)
+{
+  Pass * p = ctx->pass;
+
+  if (p == NULL)
+  {
+    writerRange (w, first, last);
+    return;
+  }
+
+  first += p->base;
+  last  += p->base;
+  if (p->runLast != 0 && p->runLast + 1 == first)
+    first = p->runFirst;
+  else if (p->runLast != 0)
+    writerRange (w, p->runFirst, p->runLast);
+  p->runFirst = first;
+  p->runLast  = last;
+}
+
+/*
+ * Write the set as runs of consecutive IDs, "first-last" (or just "id"
+ * for a run of one). Runs are found a word at a time: a zero word
+ * outside a run, or a word of all ones inside one, is skipped whole.
+ */
+static void
+setWriteRanges (FsContext * ctx, Set * s, Writer * w)
+{
+  uint64 * words = (uint64 *) s->vector;
+  uint64   nWords = vectorWords(ctx);
+  uint64   id, first = 0;
+  boolean  inRun = FALSE;
+
+  for (id = 1; id <= ctx->max; )
+  {
+    if (id % sizeof(uint64) == 0 && id / sizeof(uint64) < nWords &&
+        words[id / sizeof(uint64)] == (inRun ? 0x0101010101010101UL : 0))
+    {
+      id += sizeof(uint64);
+      continue;
+    }
+
+    if (s->vector[id] && ! inRun)
+    {
+      first = id;
+      inRun = TRUE;
+    }
+    else if ( ! s->vector[id] && inRun)
+    {
+      runWrite (ctx, w, first, id - 1);
+      inRun = FALSE;
+    }
+    id++;
+  }
+
+  if (inRun)
+    runWrite (ctx, w, first, ctx->max);
+}
+
+/*
+ * Build the history "( h1 op h2 op ... hn )", or "( h1 h2 ... hn )" if
+ * op is 0, taking ownership of (and freeing) the pieces. NULL if it
+ * can't be allocated.
+ */
+static char *
+historyJoin (FsContext * ctx, char ** pieces, uint32 n, char op)
+{
+  uint32 i;
+  size_t len;
+  char * buf, * p;
+
+  for (i = 0, len = 3; i < n; i++)
+    len += strlen(pieces[i]) + 3;
+
+  if ((buf = ctxAlloc (ctx, len)) != NULL)
+  {
+    p = buf;
+    *p++ = '(';
+    for (i = 0; i < n; i++)
+    {
+      if (i > 0 && op)
+      {
+        *p++ = ' ';
+        *p++ = op;
+      }
+      *p++ = ' ';
+      strcpy(p, pieces[i]);
+      p += strlen(pieces[i]);
+    }
+    strcpy(p, " )");
+  }
+
+  for (i = 0; i < n; i++)
+    ctxFree(ctx, pieces[i]);
+
+  return (buf);
+}
+
+static void
+foldWords (Sweep * w)
+{
+  const char * ops = w->arg;
+  uint64     * a, * v;
+  uint64       b, end, i;
+  uint32       j;
+
+  a = (uint64 *) w->acc->vector;
+
+  for (b = w->lo; b < w->hi; b += BLOCK_WORDS)
+  {
+    end = (b + BLOCK_WORDS < w->hi) ? b + BLOCK_WORDS : w->hi;
+
+    for (j = 0; j < w->n; j++)
+    {
+      v = (uint64 *) w->sets[j]->vector;
+      switch (ops[j])
+      {
+        case 'U':
+          for (i = b; i < end; i++)
+            a[i] |= v[i];
+          break;
+        case 'X':
+          for (i = b; i < end; i++)
+            a[i] &= v[i];
+          break;
+        case 'D':
+          for (i = b; i < end; i++)
+            a[i] &= ~v[i];
+          break;
+        case 'N':
+          for (i = b; i < end; i++)
+            a[i] |= ~v[i] & 0x0101010101010101UL;
+          break;
+        default:
+          assert(0);
+      }
+    }
+  }
+}
+
+/*
+ * How to fold a set into acc with op on their vectors as stored, given
+ * which of them are complemented. By De Morgan every case comes down
+ * to a |= b, a &= b, a &= ~b or a |= ~b ('U', 'X', 'D' or 'N'): with
+ * acc complemented, ~a U B is ~(a & ~B), ~a X B is ~(a | ~B) and ~a D B
+ * is ~(a | B), and a complemented B swaps b for ~b.
+ */
+static char
+foldOp (uint64 op, boolean accComplement, boolean complement)
+{
+  boolean isOr, negate;
+
+  if (accComplement)
+  {
+    isOr   = (op != 'U');
+    negate = (op != 'D');
+  }
+  else
+  {
+    isOr   = (op == 'U');
+    negate = (op == 'D');
+  }
+  if (complement)
+    negate = ! negate;
+
+  return (isOr ? (negate ? 'N' : 'U') : (negate ? 'D' : 'X'));
+}
+
+/*
+ * Fold n sets into acc with operator op (U, X or D) in a single pass.
+ * The vectors are walked a block at a time and every input is applied
+ * to a block while it is still in cache, rather than sweeping the whole
+ * of acc once per input. Vector bytes are 0 or 1, so whole 64-bit words
+ * can be combined at once. Complemented sets are folded as they are,
+ * with foldOp(), and acc keeps its own complement flag.
+ */
+static void
+setFold (FsContext * ctx, Set * acc, uint64 op, Set ** sets, uint32 n)
+{
+  Sweep    w;
+  char     ops[NARY_BATCH];
+  uint64   i;
+  uint32   j, k;
+
+  /* sets come NARY_BATCH at a time from setCombine(); API callers may pass more */
+  if (n > NARY_BATCH)
+  {
+    for (k = 0; k < n; k += NARY_BATCH)
+      setFold (ctx, acc, op, sets + k, (n - k < NARY_BATCH) ? n - k : NARY_BATCH);
+    return;
+  }
+
+  for (j = 0; j < n; j++)
+    ops[j] = foldOp (op, acc->complement, sets[j]->complement);
+
+  memset(&w, 0, sizeof(w));
+  w.fn   = foldWords;
+  w.acc  = acc;
+  w.sets = sets;
+  w.n    = n;
+  w.arg  = ops;
+  sweep (ctx, &w);
+
+  /* the bytes past the last whole word */
+  for (i = vectorWords(ctx) * sizeof(uint64); i <= ctx->max; i++)
+    for (j = 0; j < n; j++)
+      switch (ops[j])
+      {
+        case 'U': acc->vector[i] |= sets[j]->vector[i];  break;
+        case 'X': acc->vector[i] &= sets[j]->vector[i];  break;
+        case 'D': acc->vector[i] &= ~sets[j]->vector[i]; break;
+        case 'N': acc->vector[i] |= ~sets[j]->vector[i] & 1; break;
+      }
+
+  /* ID 0 is never a member, nor in a complement's vector */
+  acc->vector[0] = 0;
+}
+
+static void
+normalizeWords (Sweep * w)
+{
+  uint64 i;
+
+  for (i = w->lo * sizeof(uint64); i < w->hi * sizeof(uint64); i++)
+    w->acc->vector[i] = (w->acc->vector[i] == w->gen);
+}
+
+/*
+ * Collapse generation marks left by intersecting files into acc: only
+ * the IDs that reached generation gen are still in the set.
+ */
+static void
+setNormalize (FsContext * ctx, Set * s, char gen)
+{
+  Sweep  w;
+  uint64 i;
+
+  memset(&w, 0, sizeof(w));
+  w.fn  = normalizeWords;
+  w.acc = s;
+  w.gen = gen;
+  sweep (ctx, &w);
+
+  for (i = vectorWords(ctx) * sizeof(uint64); i <= ctx->max; i++)
+    s->vector[i] = (s->vector[i] == gen);
+}
+
+static void
+countWords (Sweep * w)
+{
+  unsigned char * c, * v;
+  unsigned char   k = (unsigned char) w->gen;
+  uint64          b, end, i;
+  uint32          j;
+
+  c = (unsigned char *) w->acc->vector;
+
+  for (b = w->lo * sizeof(uint64); b < w->hi * sizeof(uint64); b += BLOCK_WORDS * sizeof(uint64))
+  {
+    end = (b + BLOCK_WORDS * sizeof(uint64) < w->hi * sizeof(uint64)) ?
+          b + BLOCK_WORDS * sizeof(uint64) : w->hi * sizeof(uint64);
+
+    for (j = 0; j < w->n; j++)
+    {
+      v = (unsigned char *) w->sets[j]->vector;
+      for (i = b; i < end; i++)
+        c[i] = (c[i] + v[i] > k) ? k : c[i] + v[i];
+    }
+  }
+}
+
+/*
+ * Add the members of n sets to the per-ID counters in acc, stopping at
+ * k. Like setFold(), each block of counters takes all n sets while it
+ * is in cache.
+ */
+static void
+setCount (FsContext * ctx, Set * acc, Set ** sets, uint32 n, char k)
+{
+  Sweep    w;
+  uint64   i;
+  uint32   j;
+  unsigned char * c = (unsigned char *) acc->vector;
+
+  memset(&w, 0, sizeof(w));
+  w.fn   = countWords;
+  w.acc  = acc;
+  w.sets = sets;
+  w.n    = n;
+  w.gen  = k;
+  sweep (ctx, &w);
+
+  for (i = vectorWords(ctx) * sizeof(uint64); i <= ctx->max; i++)
+    for (j = 0; j < n; j++)
+      c[i] = (c[i] + sets[j]->vector[i] > (unsigned char) k) ? (unsigned char) k : c[i] + sets[j]->vector[i];
+}
+
+static void
+invertWords (Sweep * w)
+{
+  uint64 * a;
+  uint64   i;
+
+  a = (uint64 *) w->acc->vector;
+  for (i = w->lo; i < w->hi; i++)
+    a[i] ^= 0x0101010101010101UL;
+}
+
+static void setRankClear (FsContext * ctx, Set * s);
+
+/*
+ * Make the vector of a complemented set hold its members again. This
+ * is the one sweep that inverting a set used to cost; it's only paid
+ * by what needs the members themselves (writing, the rank index).
+ */
+static void
+setMaterialize (FsContext * ctx, Set * s)
+{
+  Sweep    w;
+  uint64   i;
+
+  if ( ! s->complement)
+    return;
+
+  memset(&w, 0, sizeof(w));
+  w.fn  = invertWords;
+  w.acc = s;
+  sweep (ctx, &w);
+
+  /* ID 0 is never a member */
+  s->vector[0] = 0;
+
+  for (i = vectorWords(ctx) * sizeof(uint64); i <= ctx->max; i++)
+    s->vector[i] = ! s->vector[i];
+
+  s->complement = FALSE;
+  setRankClear (ctx, s);
+}
+
+/*
+ * Complement s in O(1): only its flag changes, and every operator and
+ * reader takes the flag into account (see foldOp()), so I ( a U b ) X c
+ * is one AND-NOT pass rather than an inversion sweep and then an AND.
+ */
+static FsStatus
+setInvert (FsContext * ctx, Set * s)
+{
+  char   * buf;
+  FsStatus status;
+
+  if (s->type == SFILE && (status = setRead(ctx, s)) != FS_OK)
+    return (status);
+
+  assert(s->type == SET);
+
+  if ((buf = ctxAlloc (ctx, strlen(s->x.history) + 7)) == NULL)
+    return (ctx->status);
+
+  s->complement = ! s->complement;
+
+  sprintf (buf, "( I %s )", s->x.history);
+  ctxFree(ctx, s->x.history);
+  s->x.history = buf;
+
+  if (ctx->verbose) fprintf (stderr, "%s\n", s->x.history);
+
+  return (FS_OK);
+}
+
+/*
+ * The number of IDs in the set. Vector bytes are 0 or 1, so the
+ * population count of a word is the number of members in it.
+ */
+static uint64
+setSize (FsContext * ctx, const Set * s)
+{
+  uint64 * w = (uint64 *) s->vector;
+  uint64   i, n = 0;
+
+  for (i = 0; i < vectorWords(ctx); i++)
+    n += __builtin_popcountl (w[i]);
+
+  for (i = vectorWords(ctx) * sizeof(uint64); i <= ctx->max; i++)
+    n += s->vector[i];
+
+  return (s->complement ? ctx->max - n : n);
+}
+
+/*
+ * The members of the set in ascending order, as an allocated array
+ * of *idCnt IDs (NULL if the set is empty).
+ */
+static FsStatus
+setIds (FsContext * ctx, const Set * s, uint32 ** ids, uint64 * idCnt)
+{
+  uint64   i, j;
+  uint32 * array;
+
+  *ids = NULL;
+
+  /* Count the number of ID in the set */
+  if ((*idCnt = setSize (ctx, s)) == 0)
+    return (FS_OK);
+
+  if ((array = ctxAlloc (ctx, sizeof(uint32) * *idCnt)) == NULL)
+    return (ctx->status);
+
+  /* Map the set vector to an array */
+  for (i = 1, j = 0; i <= ctx->max; i++)
+    if (s->vector[i] != s->complement)
+      array[j++] = i;
+
+  *ids = array;
+  return (FS_OK);
+}
+
+/*
+ * The members of the set in random order, as an allocated array as
+ * setIds() returns.
+ */
+static void
+idsShuffle (FsContext * ctx, uint32 * array, uint64 idCnt)
+{
+  uint64   i, j;
+  uint32   tmp;
+
+  if (idCnt == 0)
+    return;
+
+  /*
+   * http://en.wikipedia.org/wiki/Fisher–Yates_shuffle
+   *
+   * To shuffle an array a of n elements (indices 0..n-1):
+   * for i from n − 1 downto 1 do
+   *    j ← random integer with 0 ≤ j ≤ i
+   *    exchange a[j] and a[i]
+   */
+  for (i = (idCnt - 1); i > 0; i--)
+  {
+    j = rngBelow (ctx, i + 1);
+
+    /* exchange values */
+    tmp = array[j];
+    array[j] = array[i];
+    array[i] = tmp;
+  }
+}
+
+static FsStatus
+setShuffle (FsContext * ctx, const Set * s, uint32 ** ids, uint64 * idCnt)
+{
+  FsStatus status;
+
+  if ((status = setIds (ctx, s, ids, idCnt)) != FS_OK)
+    return (status);
+
+  idsShuffle (ctx, *ids, *idCnt);
+
+  return (FS_OK);
+}
+
+static FsStatus
+setShuffleAndWrite (FsContext * ctx, Set * s, Writer * w)
+{
+  uint64   i, idCnt;
+  char   * buf;
+  uint32 * array;
+  FsStatus status;
+
+  if ((status = setShuffle (ctx, s, &array, &idCnt)) != FS_OK)
+    return (status);
+
+  if (ctx->verbose && (buf = ctxAlloc (ctx, strlen(s->x.history) + 7)) != NULL)
+  {
+    sprintf (buf, "( R %s )", s->x.history);
+    ctxFree(ctx, s->x.history);
+    s->x.history = buf;
+    fprintf (stderr, "%s\n", s->x.history);
+  }
+
+  for (i = 0; i < idCnt; i++)
+    writerId (w, 0, array[i]);
+
+  ctxFree(ctx, array);
+
+  return (FS_OK);
+}
+
+/* -------------------------------------------------------------------- */
+
+static void
+rankWords (Sweep * w)
+{
+  uint64 * v = (uint64 *) w->acc->vector;
+  uint64 * rank = w->acc->rank;
+  uint64   i;
+
+  for (i = w->lo; i < w->hi; i++)
+    rank[i / (RANK_BLOCK / sizeof(uint64))] += __builtin_popcountl (v[i]);
+}
+
+/*
+ * Build the rank index of s: the number of members before each block
+ * of RANK_BLOCK IDs, and the total in the extra last entry. Each thread
+ * counts the blocks of its own slice (slices are huge page aligned, so
+ * no block is split between threads) before the counts are summed.
+ */
+static FsStatus
+setRankBuild (FsContext * ctx, Set * s)
+{
+  Sweep  w;
+  uint64 blocks = (uint64) ctx->max / RANK_BLOCK + 1;
+  uint64 i, n, sum;
+
+  if (s->rank != NULL)
+    return (FS_OK);
+
+  if ((s->rank = ctxAlloc (ctx, (blocks + 1) * sizeof(uint64))) == NULL)
+    return (ctx->status);
+  memset(s->rank, 0, (blocks + 1) * sizeof(uint64));
+
+  memset(&w, 0, sizeof(w));
+  w.fn  = rankWords;
+  w.acc = s;
+  sweep (ctx, &w);
+
+  for (i = vectorWords(ctx) * sizeof(uint64); i <= ctx->max; i++)
+    s->rank[i / RANK_BLOCK] += s->vector[i];
+
+  for (i = 0, sum = 0; i <= blocks; i++)
+  {
+    n = s->rank[i];
+    s->rank[i] = sum;
+    sum += n;
+  }
+
+  return (FS_OK);
+}
+
+/* Drop the rank index of s once its members change */
+static void
+setRankClear (FsContext * ctx, Set * s)
+{
+  ctxFree(ctx, s->rank);
+  s->rank = NULL;
+}
+
+static FsStatus
+setView (FsContext * ctx, Set * s, View * v)
+{
+  FsStatus status;
+
+  setMaterialize (ctx, s);
+  if ((status = setRankBuild (ctx, s)) != FS_OK)
+    return (status);
+
+  memset(v, 0, sizeof(*v));
+  v->vector = s->vector;
+  v->rank   = s->rank;
+  v->max    = ctx->max;
+  v->count  = s->rank[ctx->max / RANK_BLOCK + 1];
+
+  return (FS_OK);
+}
+
+/* Map the binary set file file for queries, without reading its bits */
+static FsStatus
+fileViewOpen (FsContext * ctx, const char * file, View * v)
+{
+  int         fd;
+  struct stat statBuf;
+  char      * base;
+  FsStatus    status;
+
+  if ((fd = open (file, O_RDONLY)) < 0)
+    return (fsFail (ctx, FS_EIO, "can't open %s for reading", file));
+  if (fstat (fd, &statBuf) < 0)
+  {
+    close(fd);
+    return (fsFail (ctx, FS_EIO, "can't fstat %s", file));
+  }
+  if (statBuf.st_size < BITS_HEADER)
+  {
+    close(fd);
+    return (fsFail (ctx, FS_EIO, "%s: not a valid binary set file", file));
+  }
+
+  base = mmap (0, statBuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base == (char *) -1)
+    return (fsFail (ctx, FS_EIO, "can't mmap %s", file));
+
+  if ( ! bitsIs (base, statBuf.st_size))
+    status = fsFail (ctx, FS_EIO, "%s: not a valid binary set file", file);
+  else
+    status = bitsHeader (ctx, file, base, statBuf.st_size, v);
+  if (status != FS_OK)
+  {
+    munmap (base, statBuf.st_size);
+    return (status);
+  }
+
+  v->map     = base;
+  v->mapSize = statBuf.st_size;
+
+  return (FS_OK);
+}
+
+static void
+viewClose (View * v)
+{
+  if (v->map)
+    munmap (v->map, v->mapSize);
+}
+
+/* Index entry b: the number of members before ID b * RANK_BLOCK */
+static uint64
+viewIndex (const View * v, uint64 b)
+{
+  uint64 n = 0;
+  int    i;
+
+  if (v->rank)
+    return (v->rank[b]);
+  for (i = sizeof(uint64) - 1; i >= 0; i--)
+    n = (n << 8) | v->index[b * sizeof(uint64) + i];
+  return (n);
+}
+
+static boolean
+viewHas (const View * v, uint64 id)
+{
+  if (v->vector)
+    return (v->vector[id] != 0);
+  return ((v->bits[id / 8] >> (id % 8)) & 1);
+}
+
+/*
+ * Whether the 64 IDs from id (a multiple of 64) on are all members
+ * (full) or all absent (not full), so they can be skipped whole.
+ */
+static boolean
+viewSpan (const View * v, uint64 id, boolean full)
+{
+  uint64 w;
+  int    i;
+
+  if (id + 63 > v->max)
+    return (FALSE);
+
+  if (v->vector)
+  {
+    for (i = 0; i < 8; i++)
+    {
+      memcpy (&w, v->vector + id + i * sizeof(uint64), sizeof(uint64));
+      if (w != (full ? 0x0101010101010101UL : 0))
+        return (FALSE);
+    }
+    return (TRUE);
+  }
+
+  memcpy (&w, v->bits + id / 8, sizeof(uint64));
+  return (w == (full ? ~0UL : 0));
+}
+
+/* The number of members less than id: the offset id has, or would have */
+static uint64
+viewRank (const View * v, uint64 id)
+{
+  uint64 i, n;
+
+  if (id > v->max)
+    return (v->count);
+
+  n = viewIndex (v, id / RANK_BLOCK);
+  for (i = id / RANK_BLOCK * RANK_BLOCK; i < id; )
+  {
+    if (i % 64 == 0 && i + 64 <= id && viewSpan (v, i, FALSE))
+    {
+      i += 64;
+      continue;
+    }
+    n += viewHas (v, i++);
+  }
+
+  return (n);
+}
+
+/*
+ * The member at offset k (k < v->count): binary search the index for
+ * the last block starting at or before it, then count through the
+ * block.
+ */
+static uint32
+viewSelect (const View * v, uint64 k)
+{
+  uint64 lo = 0, hi = v->max / RANK_BLOCK, mid;
+  uint64 id, n;
+
+  while (lo < hi)
+  {
+    mid = (lo + hi + 1) / 2;
+    if (viewIndex (v, mid) <= k)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+
+  n = viewIndex (v, lo);
+  for (id = lo * RANK_BLOCK; ; id++)
+  {
+    if (id % 64 == 0 && id + 64 <= v->max && viewSpan (v, id, FALSE))
+    {
+      id += 63;
+      continue;
+    }
+    /* max itself is a member here, unless a binary set file's index disagrees with its bits */
+    if ((viewHas (v, id) && n++ == k) || id == v->max)
+      return (id);
+  }
+}
+
+/*
+ * Write one page of the members in [first, last]: skip the first
+ * offset of them and write at most limit (FS_NO_LIMIT for all), as IDs
+ * or ranges. The index finds where the page starts and ends, so only
+ * the page itself is scanned.
+ */
+static FsStatus
+viewWritePage (FsContext * ctx, const View * v, FILE * fp, FsFormat format,
+               uint32 first, uint32 last, uint64 offset, uint64 limit)
+{
+  Writer   w;
+  uint64   start, total, id, lo, hi, runFirst = 0;
+  boolean  inRun = FALSE;
+  FsStatus status;
+
+  if (format != FS_FORMAT_IDS && format != FS_FORMAT_RANGES)
+    return (fsFail (ctx, FS_EINVAL, "a page can only be written as IDs or ranges"));
+
+  if (first < 1)
+    first = 1;
+  if (last > v->max)
+    last = v->max;
+  if (first > last || limit == 0)
+    return (FS_OK);
+
+  total = viewRank (v, (uint64) last + 1);
+  start = viewRank (v, first);
+  if (total < start || offset >= total - start)
+    return (FS_OK);
+  start += offset;
+
+  lo = viewSelect (v, start);
+  hi = (limit < total - start) ? viewSelect (v, start + limit - 1) : last;
+
+  if ((status = writerOpen (ctx, fp, &w)) != FS_OK)
+    return (status);
+  for (id = lo; id <= hi; )
+  {
+    if (id % 64 == 0 && id + 63 <= hi && viewSpan (v, id, inRun))
+    {
+      id += 64;
+      continue;
+    }
+
+    if (format == FS_FORMAT_IDS)
+    {
+      if (viewHas (v, id))
+        writerId (&w, 0, id);
+    }
+    else if (viewHas (v, id) && ! inRun)
+    {
+      runFirst = id;
+      inRun    = TRUE;
+    }
+    else if ( ! viewHas (v, id) && inRun)
+    {
+      writerRange (&w, runFirst, id - 1);
+      inRun = FALSE;
+    }
+    id++;
+  }
+
+  if (inRun)
+    writerRange (&w, runFirst, hi);
+
+  return (writerClose (ctx, &w));
+}
+
+/* The number of members among the 64 IDs from id (a multiple of 64) on */
+POPCOUNT_CLONES
+static uint32
+viewCount64 (const View * v, uint64 id)
+{
+  uint64 w;
+  uint32 n = 0;
+  int    i;
+
+  if (id + 63 > v->max)
+  {
+    for (i = 0; i < 64 && id + i <= v->max; i++)
+      n += viewHas (v, id + i);
+    return (n);
+  }
+
+  if (v->vector)
+  {
+    for (i = 0; i < 8; i++)
+    {
+      memcpy (&w, v->vector + id + i * sizeof(uint64), sizeof(uint64));
+      n += __builtin_popcountl (w);
+    }
+    return (n);
+  }
+
+  memcpy (&w, v->bits + id / 8, sizeof(uint64));
+  return (__builtin_popcountl (w));
+}
+
+/*
+ * The members at the k ascending offsets ranks, in one pass: binary
+ * search the index forward for the block holding the next offset, then
+ * step through the block 64 IDs at a time by their counts, looking at
+ * single IDs only where an offset falls. The cost is in k and the
+ * blocks touched, not the size of the set.
+ */
+static void
+viewSelectSorted (const View * v, const uint64 * ranks, uint64 k, uint32 * ids)
+{
+  uint64 b = 0, lo, hi, mid, id, end, n, i = 0;
+  uint32 c;
+
+  while (i < k)
+  {
+    for (lo = b, hi = v->max / RANK_BLOCK; lo < hi; )
+    {
+      mid = (lo + hi + 1) / 2;
+      if (viewIndex (v, mid) <= ranks[i])
+        lo = mid;
+      else
+        hi = mid - 1;
+    }
+    b = lo;
+
+    n   = viewIndex (v, b);
+    end = (b + 1) * RANK_BLOCK;
+    for (id = b * RANK_BLOCK; id < end && id <= v->max && i < k; id += 64)
+    {
+      c = viewCount64 (v, id);
+      if (n + c <= ranks[i])
+      {
+        n += c;
+        continue;
+      }
+      for (c = 0; c < 64 && i < k; c++)
+        if (viewHas (v, id + c) && n++ == ranks[i])
+          ids[i++] = id + c;
+    }
+
+    /* past the last block only if a binary set file's index disagrees with its bits */
+    if (++b > v->max / RANK_BLOCK)
+      break;
+  }
+
+  for (; i < k; i++)
+    ids[i] = v->max;
+}
+
+static int
+rankCompare (const void * a, const void * b)
+{
+  uint64 x = *(const uint64 *) a, y = *(const uint64 *) b;
+
+  return ((x > y) - (x < y));
+}
+
+/*
+ * Put k distinct offsets drawn uniformly from [lo, hi) in ranks, in
+ * ascending order, with Floyd's algorithm: for j from n - k to n - 1,
+ * take a random t <= j, or j itself if t was already taken. Taken
+ * offsets go in an open-addressed hash table of about 2k entries, so
+ * time and memory depend on k alone.
+ */
+static FsStatus
+sampleRanks (FsContext * ctx, uint64 lo, uint64 hi, uint64 k, uint64 * ranks)
+{
+  uint64 * table;
+  uint64   size, mask, j, t, h, n = hi - lo, cnt = 0;
+
+  if (k == 0)
+    return (FS_OK);
+
+  for (size = 16; size < 2 * k; size *= 2)
+    ;
+  mask = size - 1;
+  if ((table = ctxAlloc (ctx, sizeof(uint64) * size)) == NULL)
+    return (ctx->status);
+  memset(table, 0xff, sizeof(uint64) * size);
+
+  for (j = n - k; j < n; j++)
+  {
+    t = rngBelow (ctx, j + 1);
+    for (h = (t * 0x9E3779B97F4A7C15UL) & mask; table[h] != UINT64_MAX && table[h] != t; h = (h + 1) & mask)
+      ;
+    if (table[h] == t)
+      for (t = j, h = (t * 0x9E3779B97F4A7C15UL) & mask; table[h] != UINT64_MAX; h = (h + 1) & mask)
+        ;
+    table[h] = t;
+    ranks[cnt++] = lo + t;
+  }
+  ctxFree(ctx, table);
+
+  qsort (ranks, k, sizeof(uint64), rankCompare);
+
+  return (FS_OK);
+}
+
+/*
+ * Sample k members of v uniformly without replacement (all of them if
+ * there are no more than k), as an allocated array of *n ascending
+ * IDs. With strata > 1, [1, max] is split into that many equal ranges
+ * of IDs and each gets a share of k in proportion to its members,
+ * rounded down or up at random so that every range's expected share
+ * is exact, and each is represented by its share rather than only on
+ * average.
+ */
+static FsStatus
+viewSample (FsContext * ctx, const View * v, uint64 k, uint32 strata, uint32 ** ids, uint64 * n)
+{
+  uint64 * ranks, * lo = NULL, * want = NULL, * rem = NULL;
+  uint32 * order = NULL;
+  uint64   width, given, point = 0, sum, i, total = v->count;
+  uint32   j;
+  FsStatus status = FS_OK;
+
+  *ids = NULL;
+  *n   = (k < total) ? k : total;
+  if (*n == 0)
+    return (FS_OK);
+
+  if (strata < 1)
+    strata = 1;
+  if (strata > v->max)
+    strata = v->max;
+
+  if ((ranks = ctxAlloc (ctx, sizeof(uint64) * *n)) == NULL ||
+      (lo = ctxAlloc (ctx, sizeof(uint64) * (strata + 1))) == NULL ||
+      (want = ctxAlloc (ctx, sizeof(uint64) * strata)) == NULL ||
+      (rem = ctxAlloc (ctx, sizeof(uint64) * strata)) == NULL ||
+      (order = ctxAlloc (ctx, sizeof(uint32) * strata)) == NULL)
+  {
+    status = ctx->status;
+    goto done;
+  }
+
+  /* the members of stratum j are offsets lo[j] to lo[j + 1] - 1 */
+  width = ((uint64) v->max + strata - 1) / strata;
+  for (j = 0; j < strata; j++)
+    lo[j] = viewRank (v, 1 + j * width);
+  lo[strata] = total;
+
+  /*
+   * Both factors are under 2^32, so the products fit. A stratum with a
+   * remainder has fewer than all its members wanted, so it can take one
+   * more, and fewer than strata are short.
+   */
+  for (j = 0, given = 0; j < strata; j++)
+  {
+    want[j] = *n * (lo[j + 1] - lo[j]) / total;
+    rem[j]  = *n * (lo[j + 1] - lo[j]) % total;
+    given  += want[j];
+  }
+
+  /*
+   * The units left over go by systematic selection: the remainders laid
+   * end to end in a random order of strata (they add up to a whole total
+   * per unit), and points total apart from a random start. Each
+   * remainder is less than total, so it holds at most one point, with
+   * probability remainder / total.
+   */
+  if (given < *n)
+  {
+    for (j = 0; j < strata; j++)
+      order[j] = j;
+    idsShuffle (ctx, order, strata);
+    point = rngBelow (ctx, total);
+  }
+  for (j = 0, sum = 0; j < strata && given < *n; j++)
+  {
+    sum += rem[order[j]];
+    if (point < sum)
+    {
+      want[order[j]]++;
+      given++;
+      point += total;
+    }
+  }
+
+  for (j = 0, i = 0; j < strata && status == FS_OK; j++)
+  {
+    status = sampleRanks (ctx, lo[j], lo[j + 1], want[j], ranks + i);
+    i += want[j];
+  }
+  if (status != FS_OK)
+    goto done;
+
+  if ((*ids = ctxAlloc (ctx, sizeof(uint32) * *n)) == NULL)
+  {
+    status = ctx->status;
+    goto done;
+  }
+  viewSelectSorted (v, ranks, *n, *ids);
+
+done:
+  if (status != FS_OK)
+    *n = 0;
+  ctxFree(ctx, ranks);
+  ctxFree(ctx, lo);
+  ctxFree(ctx, want);
+  ctxFree(ctx, rem);
+  ctxFree(ctx, order);
+  return (status);
+}
+
+/* -------------------------------------------------------------------- */
+
+/*
+ * Pack the vector of s into the bitmap bits (Overlap), clearing the
+ * vector as it goes so it can take the next file.
+ */
+static void
+setPack (FsContext * ctx, Set * s, uint64 * bits, uint64 words)
+{
+  uint64 i, w, n;
+  uint32 b;
+
+  for (i = 0; i < words; i++)
+  {
+    n = ((uint64) ctx->max + 1 - i * 64 < 64) ? (uint64) ctx->max + 1 - i * 64 : 64;
+    for (b = 0, w = 0; b < n; b++)
+      w |= (uint64) (s->vector[i * 64 + b] != 0) << b;
+    bits[i] = w;
+  }
+  memset (s->vector, 0, (uint64) ctx->max + 1);
+}
+
+/*
+ * Add the intersection counts of every pair of sets over this thread's
+ * slice. The slice is taken OVERLAP_BLOCK words at a time, so a block
+ * of every set stays in cache while all the pairs use it, and within
+ * a block the pairs go OVERLAP_TILE x OVERLAP_TILE at a time, so each
+ * word loaded is ANDed with OVERLAP_TILE others while it is in a
+ * register. Rows past the last set repeat it and are ignored.
+ */
+POPCOUNT_CLONES
+static void
+overlapWords (Sweep * w)
+{
+  Overlap * o = w->arg;
+  uint64  * a[OVERLAP_TILE], * c[OVERLAP_TILE];
+  uint64    sum[OVERLAP_TILE][OVERLAP_TILE];
+  uint64    lo, hi, b, end, k;
+  uint32    i, j, x, y;
+
+  /* sweep() slices vector words (8 IDs); bitmap words hold 64 */
+  lo = w->lo / 8;
+  hi = (w->hi == o->vectorWords) ? o->words : w->hi / 8;
+
+  for (b = lo; b < hi; b += OVERLAP_BLOCK)
+  {
+    end = (b + OVERLAP_BLOCK < hi) ? b + OVERLAP_BLOCK : hi;
+
+    for (i = 0; i < o->n; i += OVERLAP_TILE)
+      for (j = i; j < o->n; j += OVERLAP_TILE)
+      {
+        for (x = 0; x < OVERLAP_TILE; x++)
+        {
+          a[x] = o->bits[(i + x < o->n) ? i + x : o->n - 1];
+          c[x] = o->bits[(j + x < o->n) ? j + x : o->n - 1];
+        }
+        memset(sum, 0, sizeof(sum));
+
+        for (k = b; k < end; k++)
+          for (x = 0; x < OVERLAP_TILE; x++)
+            for (y = 0; y < OVERLAP_TILE; y++)
+              sum[x][y] += __builtin_popcountl (a[x][k] & c[y][k]);
+
+        for (x = 0; x < OVERLAP_TILE && i + x < o->n; x++)
+          for (y = 0; y < OVERLAP_TILE && j + y < o->n; y++)
+            if (j + y >= i + x)
+              __atomic_fetch_add (&o->counts[(i + x) * o->n + j + y], sum[x][y], __ATOMIC_RELAXED);
+      }
+  }
+}
+
+/*
+ * Fill counts (n x n) with the size of the intersection of every pair
+ * of files. Each file is read once, into one scratch vector, and kept
+ * as a bitmap an eighth of its size, so that hundreds of sets fit in
+ * memory; the pairs are then counted in a single threaded sweep.
+ */
+static FsStatus
+overlap (FsContext * ctx, const char * const * files, uint32 n, uint64 * counts)
+{
+  Overlap  o;
+  Sweep    w;
+  Set    * scratch;
+  uint32   i, j;
+  FsStatus status = FS_OK;
+
+  memset(&o, 0, sizeof(o));
+  o.n           = n;
+  o.words       = (uint64) ctx->max / 64 + 1;
+  o.vectorWords = vectorWords(ctx);
+  o.counts      = counts;
+  memset(counts, 0, sizeof(uint64) * n * n);
+
+  if (n == 0)
+    return (FS_OK);
+
+  if ((o.bits = ctxAlloc (ctx, sizeof(uint64 *) * n)) == NULL)
+    return (ctx->status);
+  memset(o.bits, 0, sizeof(uint64 *) * n);
+  if ((scratch = setNew(ctx)) == NULL)
+  {
+    ctxFree(ctx, o.bits);
+    return (ctx->status);
+  }
+
+  for (i = 0; i < n && status == FS_OK; i++)
+  {
+    if ((o.bits[i] = ctxAlloc (ctx, sizeof(uint64) * o.words)) == NULL)
+      status = ctx->status;
+    else if ((status = setReadMark (ctx, scratch, files[i], 0, 0, 1)) == FS_OK)
+      setPack (ctx, scratch, o.bits[i], o.words);
+  }
+  setFree (ctx, scratch);
+
+  if (status == FS_OK)
+  {
+    if (ctx->verbose) fprintf (stderr, "overlap: %u files, %u pairs\n", n, n * (n + 1) / 2);
+
+    memset(&w, 0, sizeof(w));
+    w.fn  = overlapWords;
+    w.arg = &o;
+    sweep (ctx, &w);
+
+    for (i = 0; i < n; i++)
+      for (j = 0; j < i; j++)
+        counts[i * n + j] = counts[j * n + i];
+  }
+
+  for (i = 0; i < n; i++)
+    ctxFree(ctx, o.bits[i]);
+  ctxFree(ctx, o.bits);
+
+  return (status);
+}
+
+/*
+ * Write s as a binary set file (see bitsHeader()): its rank index,
+ * then its members as a bit vector, so that later queries can jump
+ * straight to an offset or ID without reading the rest.
+ */
+static FsStatus
+setWriteBinary (FsContext * ctx, Set * s, Writer * w)
+{
+  char     header[BITS_HEADER];
+  unsigned char buf[sizeof(uint64)];
+  uint64   blocks = (uint64) ctx->max / RANK_BLOCK + 1;
+  uint64   i, n;
+  int      j, c;
+  FsStatus status;
+
+  if ((status = setRankBuild (ctx, s)) != FS_OK)
+    return (status);
+
+  memset(header, '\n', sizeof(header));
+  n = snprintf (header, sizeof(header), BITS_MAGIC "max %u\ncount %lu\nblock %u\n",
+                ctx->max, s->rank[blocks], RANK_BLOCK);
+  header[n] = '\n';
+  writerBytes (w, header, sizeof(header));
+
+  for (i = 0; i < blocks; i++)
+  {
+    for (j = 0, n = s->rank[i]; j < (int) sizeof(uint64); j++, n >>= 8)
+      buf[j] = n & 0xff;
+    writerBytes (w, buf, sizeof(buf));
+  }
+
+  for (i = 0; i < bitsBytes(ctx->max) * 8; i += 8)
+  {
+    for (j = 0, c = 0; j < 8 && i + j <= ctx->max; j++)
+      c |= (s->vector[i + j] != 0) << j;
+    if (w->pos > w->end)
+      writerFlush (w);
+    *w->pos++ = c;
+  }
+
+  return (FS_OK);
+}
+
+/* -------------------------------------------------------------------- */
+
+static Stack *
+stackNew (FsContext * ctx)
+{
+  Stack * s;
+
+  if ((s = ctxAlloc (ctx, sizeof(Stack))) == NULL)
+    return (NULL);
+  memset(s, 0, sizeof(Stack));
+  s->depth = -1;
+
+  return (s);
+}
+
+/* Free the stack and, if tokens, the token trees still on it */
+static void
+stackFree (FsContext * ctx, Stack * s, boolean tokens)
+{
+  int32 i;
+
+  if (s == NULL)
+    return;
+
+  if (tokens)
+    for (i = s->base; i <= s->depth; i++)
+      tokenTreeFree (ctx, s->data[i]);
+
+  ctxFree(ctx, s->data);
+  ctxFree(ctx, s);
+}
+
+static boolean
+stackEmpty (Stack * s)
+{
+  return (s->depth < s->base);
+}
+
+static FsStatus
+stackPush(FsContext * ctx, Stack * s, void * data)
+{
+  void ** p;
+
+  if (s->depth + 1 == s->size)
+  {
+    if ((p = ctxRealloc (ctx, s->data, sizeof(void *) * (s->size + STACK_CHUNK))) == NULL)
+      return (ctx->status);
+    s->data  = p;
+    s->size += STACK_CHUNK;
+  }
+
+  s->depth++;
+  s->data[s->depth] = data;
+  return (FS_OK);
+}
+
+static FsStatus
+stackPushOp (FsContext * ctx, Stack * s, uint64 c)
+{
+  Token * t;
+
+  if ((t = tokenNew(ctx)) == NULL)
+    return (ctx->status);
+  t->type = OPERATOR;
+  t->x.operator = c;
+
+  if (stackPush(ctx, s, t) != FS_OK)
+  {
+    tokenFree(ctx, t);
+    return (ctx->status);
+  }
+  return (FS_OK);
+}
+
+static FsStatus
+stackPushFile (FsContext * ctx, Stack * s, char * filePath)
+{
+  Token * t;
+
+  if ((t = tokenNew(ctx)) == NULL)
+    return (ctx->status);
+  t->type = SFILE;
+  if ((t->x.file = ctxStrdup(ctx, filePath)) == NULL || stackPush(ctx, s, t) != FS_OK)
+  {
+    tokenFree(ctx, t);
+    return (ctx->status);
+  }
+  return (FS_OK);
+}
+
+
+static void *
+stackPop (Stack * s)
+{
+  void * data;
+
+  if (stackEmpty(s))
+    return (0);
+
+  data = s->data[s->depth];
+  s->depth--;
+
+  return (data);
+}
+
+static void *
+stackPeek (Stack * s)
+{
+  void * data;
+
+  if (stackEmpty(s))
+    return (0);
+
+  data = s->data[s->depth];
+
+  return (data);
+}
+
+static int32
+stackDepth (Stack * s)
+{
+  return (s->depth - s->base + 1);
+}
+
+/*
+ * pop an item from the beginning of the stack
+ */
+static void *
+stackShift (Stack * s)
+{
+  void * data;
+
+  if (stackEmpty(s))
+    return (0);
+
+  data = s->data[s->base];
+  s->base++;
+
+  return (data);
+}
+
+static void
+stackDump (Stack * s)
+{
+  int i;
+
+  fprintf (stderr, "stackDump(): depth= %d\n", s->depth);
+  for (i = s->depth; i >= s->base; i--)
+    fprintf (stderr, "\t %d:  %c  %p\n", i, (unsigned char) (uint64) s->data[i],  s->data[i]);
+}
+
+
+/*
+ * operators (higher = greater)
+ * precedence   operators       associativity
+ * 2            I               left to right
+ * 1            U X D           left to right
+ */
+static int
+op_preced (const char c)
+{
+  switch (c)
+  {
+    case 'I':
+      return 2;
+    case 'U':  case 'X': case 'D':
+      return 1;
+    default:
+      assert(0);
+  }
+  return 0;
+}
+
+static boolean
+op_left_assoc (const char c)
+{
+  switch(c)
+  {
+    /* left to right */
+    case 'U': case 'X': case 'D': case 'I':
+      return TRUE;
+/*
+    case 'I':                                  // right to left
+      return FALSE;
+ */
+    default:
+      assert(0);
+  }
+  return FALSE;
+}
+
+static unsigned int
+op_arg_count (const char c)
+{
+  switch(c)
+  {
+    case 'U': case 'X': case 'D':
+      return 2;
+    case 'I':
+      return 1;
+    default:
+      assert(0);
+  }
+  return 0;
+}
+
+
+/*
+ * Can the operands of arg, the i'th operand of tok, be merged into tok?
+ * True of a union of unions, an intersection of intersections and a
+ * difference whose left operand is itself a difference.
+ */
+static boolean
+op_splices (Token * tok, Token * arg, uint32 i)
+{
+  if (arg->type != OPERATOR || arg->x.operator != tok->x.operator)
+    return FALSE;
+
+  switch (tok->x.operator)
+  {
+    case 'U': case 'X':
+      return TRUE;
+    case 'D':
+      return (i == 0);
+    default:
+      return FALSE;
+  }
+}
+
+/*
+ * Parse input into postfix tokens on outputStack (shunting-yard). On
+ * failure the tokens already pushed are left for the caller to free.
+ */
+static FsStatus
+convertToPostfix (FsContext * ctx, const char *input, Stack * outputStack)
+{
+  boolean pe = FALSE;
+  Stack * opStack = NULL;
+  Stack * tStack  = NULL;
+  Token * t;
+  uint64  c;
+  uint64  sc;
+  char  * tok;
+  char  * buffer;
+  char  * end;
+  char  * save;
+  long    k;
+  FsStatus status = FS_OK;
+
+  /* Since strtok_r() mangles the input, make a copy before calling. */
+  if ((buffer = ctxStrdup (ctx, input)) == NULL)
+    return (ctx->status);
+
+  opStack = stackNew(ctx);
+  tStack  = stackNew(ctx);   /* T operators whose operand lists are open */
+  if (opStack == NULL || tStack == NULL)
+  {
+    status = ctx->status;
+    goto done;
+  }
+
+  tok = strtok_r(buffer, " \t\r\n", &save); /* Pull the first token */
+  while (tok != NULL && status == FS_OK)
+  {
+    c = tok[0];
+
+    /* If the token is an operator (U, X, D, I), then: */
+    if (strlen(tok) == 1 && is_operator(c))
+    {
+      if ((uint64) stackPeek (opStack) == 'T')
+      {
+        status = fsFail (ctx, FS_ESYNTAX, "expressions in a T operand list must be in parentheses");
+        break;
+      }
+
+      while ( ! stackEmpty (opStack) && status == FS_OK)
+      {
+        sc = (unsigned long int) stackPeek(opStack);
+
+        /* While there is an operator token, o2, at the top of the opStack
+         * op1 is left-associative and its precedence is less than or equal to that of op2,
+         * or op1 is right-associative and its precedence is less than that of op2,
+         */
+        if (is_operator(sc) &&
+            ((op_left_assoc(c) && (op_preced(c) <= op_preced(sc))) ||
+             (!op_left_assoc(c) && (op_preced(c) < op_preced(sc)))))
+        {
+          /* Pop o2 off the opStack, onto the outStack queue; */
+          status = stackPushOp (ctx, outputStack, (uint64) stackPop(opStack));
+        }
+        else
+          break;
+      }
+
+      /*  push op1 onto the opStack. */
+      if (status == FS_OK)
+        status = stackPush (ctx, opStack, (void *) c);
+    }
+    /*
+     * T k ( operand operand ... ): the T marker stands in for the left
+     * paren of the operand list, and the T token on tStack counts the
+     * operands as they are completed.
+     */
+    else if (strlen(tok) == 1 && c == 'T')
+    {
+      tok = strtok_r(NULL, " \t\r\n", &save);
+      k   = (tok != NULL) ? strtol(tok, &end, 10) : 0;
+      if (tok == NULL || *end != '\0' || k < 1 || k > MAX_GENERATION)
+      {
+        status = fsFail (ctx, FS_ESYNTAX, "T must be followed by a count from 1 to %d", MAX_GENERATION);
+        break;
+      }
+
+      tok = strtok_r(NULL, " \t\r\n", &save);
+      if (tok == NULL || strcmp(tok, "(") != 0)
+      {
+        status = fsFail (ctx, FS_ESYNTAX, "T %ld must be followed by ( operand ... )", k);
+        break;
+      }
+
+      if ((t = tokenNew(ctx)) == NULL)
+      {
+        status = ctx->status;
+        break;
+      }
+      t->type      = OPERATOR;
+      t->x.operator = 'T';
+      t->threshold = k;
+      if ((status = stackPush (ctx, tStack, t)) != FS_OK)
+        tokenFree (ctx, t);
+      else
+        status = stackPush (ctx, opStack, (void *) c);
+      pe = TRUE;
+    }
+    /* If the token is a left paren, then push it onto the opStack. */
+    else if (c == '(')
+    {
+      status = stackPush (ctx, opStack, (void *) c);
+      pe = TRUE;
+    }
+    /* If the token is a right paren */
+    else if (c == ')')
+    {
+      pe = FALSE;
+
+      /* Until the token at the top of the opStack is a left paren,
+       * pop operators off the opStack and onto the output queue
+       */
+      while ( ! stackEmpty (opStack) && status == FS_OK)
+      {
+        sc = (uint64) stackPeek (opStack);
+        if (sc == '(' || sc == 'T')
+        {
+          pe = TRUE;
+          break;
+        }
+        else
+          status = stackPushOp(ctx, outputStack, (uint64) stackPop (opStack));
+      }
+      if (status != FS_OK)
+        break;
+
+      /* mismatched paren's if the opStack empties without a left paren */
+      if (pe == FALSE) {
+        if (ctx->verbose)
+          stackDump (opStack);
+        status = fsFail (ctx, FS_ESYNTAX, "parentheses mismatched");
+        break;
+      }
+
+      stackPop(opStack);  /* Pop the left paren from the opStack, but not onto the output queue. */
+
+      /* The end of a T operand list emits the T, with its operand count */
+      if (sc == 'T')
+      {
+        t = stackPop (tStack);
+        if (t->argCnt == 0)
+        {
+          status = fsFail (ctx, FS_ESYNTAX, "T %u has no operands", t->threshold);
+          tokenFree (ctx, t);
+          break;
+        }
+        if ((status = stackPush (ctx, outputStack, t)) != FS_OK)
+        {
+          tokenFree (ctx, t);
+          break;
+        }
+      }
+
+      if ((uint64) stackPeek (opStack) == 'T')
+        ((Token *) stackPeek (tStack))->argCnt++;
+   }
+
+   /*
+    * Since the token is not an operator or paren, treat
+    * it as a file by adding it to the output queue.
+    */
+   else
+   {
+     status = stackPushFile (ctx, outputStack, tok);
+
+     if ((uint64) stackPeek (opStack) == 'T')
+       ((Token *) stackPeek (tStack))->argCnt++;
+   }
+
+
+    tok = strtok_r(NULL, " \t\r\n", &save);
+  }
+
+  /* When there are no more tokens to read and
+   * while there are still operator tokens in the opStack:
+   */
+  while ( ! stackEmpty (opStack) && status == FS_OK)
+  {
+    sc = (uint64) stackPop (opStack);
+    if (sc == '(' || sc == ')' || sc == 'T')
+    {
+      status = fsFail (ctx, FS_ESYNTAX, "parentheses mismatched");
+      break;
+    }
+    status = stackPushOp(ctx, outputStack, sc);
+  }
+
+done:
+  stackFree (ctx, opStack, FALSE);
+  stackFree (ctx, tStack, TRUE);
+  ctxFree (ctx, buffer);
+
+  return (status);
+}
+
+static FsStatus nodeEval (FsContext * ctx, Token * t, uint32 * opCnt, Set ** out);
+
+/*
+ * Start the kernel reading the next input file while the current one
+ * is parsed, so disk reads overlap parsing. Only its first
+ * PREFETCH_BYTES are asked for; fileParse() reads sequentially, so
+ * readahead keeps ahead of the parse from there.
+ */
+static void
+filePrefetch (const char * file)
+{
+  int fd;
+
+  if ((fd = open (file, O_RDONLY)) >= 0)
+  {
+    posix_fadvise (fd, 0, PREFETCH_BYTES, POSIX_FADV_WILLNEED);
+    close (fd);
+  }
+}
+
+/* Prefetch operand i of t, if it is a file */
+static void
+operandPrefetch (Token * t, uint32 i)
+{
+  if (i < t->argCnt && t->args[i]->type == SFILE && t->args[i]->x.file != NULL)
+    filePrefetch (t->args[i]->x.file);
+}
+
+/*
+ * Evaluate an n-ary U, X or D node. The first operand becomes the
+ * accumulator and the rest are folded into it in order: file operands
+ * are parsed directly into the accumulator as soon as they are read,
+ * and sub-expression results are batched so that up to NARY_BATCH of
+ * them are combined in one blocked pass by setFold().
+ *
+ * Intersecting a file can't clear the IDs it doesn't contain without
+ * another sweep, so instead each file advances the IDs it shares with
+ * the accumulator to the next generation; setNormalize() drops the IDs
+ * that fell behind once, at the end (or when the mark would overflow).
+ *
+ * The operands are consumed whether or not evaluation succeeds.
+ */
+static FsStatus
+setCombine (FsContext * ctx, Token * t, uint32 * opCnt, Set ** out)
+{
+  Set    * acc = NULL, * arg;
+  Set    * batch[NARY_BATCH];
+  uint32   batchCnt = 0;
+  char  ** pieces;
+  uint32   pieceCnt = 0;
+  uint32   i, next = 0;
+  unsigned char gen = 1;
+  uint64   op  = t->x.operator;
+  FsStatus status;
+
+  *out = NULL;
+
+  if ((pieces = ctxAlloc (ctx, sizeof(char *) * t->argCnt)) == NULL)
+  {
+    status = ctx->status;
+    goto fail;
+  }
+
+  next = 1;
+  operandPrefetch (t, 1);
+  if ((status = nodeEval (ctx, t->args[0], opCnt, &acc)) != FS_OK)
+    goto fail;
+  pieces[pieceCnt++] = acc->x.history;
+  acc->x.history = NULL;
+
+  for (i = 1; i < t->argCnt; i++)
+  {
+    arg  = t->args[i];
+    next = i + 1;
+    operandPrefetch (t, next);
+
+    /* ~a X f would have to set every ID f lacks; f is folded in with the sub-expressions instead */
+    if (arg->type == SFILE && ! (acc->complement && op == 'X'))
+    {
+      pieces[pieceCnt++] = arg->x.file;
+      arg->x.file = NULL;
+      tokenFree (ctx, arg);
+
+      /* a complemented acc holds the IDs not in the set: ~a U f is ~(a D f), ~a D f is ~(a U f) */
+      switch (acc->complement ? (op == 'U' ? 'D' : 'U') : op)
+      {
+        case 'U':
+          status = setReadMark (ctx, acc, pieces[i], 0, 0, 1);
+          break;
+        case 'D':
+          status = setReadMark (ctx, acc, pieces[i], 0, 1, 0);
+          break;
+        case 'X':
+          if (gen == MAX_GENERATION)
+          {
+            setNormalize (ctx, acc, gen);
+            gen = 1;
+          }
+          status = setReadMark (ctx, acc, pieces[i], 0, gen, gen + 1);
+          gen++;
+          break;
+      }
+      if (status != FS_OK)
+        goto fail;
+      continue;
+    }
+
+    if ((status = nodeEval (ctx, arg, opCnt, &arg)) != FS_OK)
+      goto fail;
+    pieces[pieceCnt++] = arg->x.history;
+    arg->x.history = NULL;
+    batch[batchCnt++] = arg;
+
+    if (batchCnt == NARY_BATCH)
+    {
+      if (gen != 1)
+      {
+        setNormalize (ctx, acc, gen);
+        gen = 1;
+      }
+      setFold (ctx, acc, op, batch, batchCnt);
+      while (batchCnt > 0)
+        setFree (ctx, batch[--batchCnt]);
+    }
+  }
+
+  if (batchCnt > 0)
+  {
+    if (gen != 1)
+    {
+      setNormalize (ctx, acc, gen);
+      gen = 1;
+    }
+    setFold (ctx, acc, op, batch, batchCnt);
+    while (batchCnt > 0)
+      setFree (ctx, batch[--batchCnt]);
+  }
+
+  if (gen != 1)
+    setNormalize (ctx, acc, gen);
+
+  acc->x.history = historyJoin (ctx, pieces, t->argCnt, (char) op);
+  pieceCnt = 0;
+  if (acc->x.history == NULL)
+  {
+    status = ctx->status;
+    goto fail;
+  }
+  ctxFree(ctx, pieces);
+
+  *out = acc;
+  return (FS_OK);
+
+fail:
+  for (i = next; i < t->argCnt; i++)
+    tokenTreeFree (ctx, t->args[i]);
+  while (batchCnt > 0)
+    setFree (ctx, batch[--batchCnt]);
+  while (pieceCnt > 0)
+    ctxFree (ctx, pieces[--pieceCnt]);
+  ctxFree (ctx, pieces);
+  if (acc != NULL)
+    setFree (ctx, acc);
+
+  return (status);
+}
+
+/*
+ * Evaluate T k ( a1 ... an ): the IDs in at least k of the operands.
+ * Each ID gets a small counter (a byte, stopping at k). File operands
+ * are counted while they are parsed, with a second vector recording
+ * the last file to count each ID so repeated lines only count once;
+ * sub-expression results are added in batches by setCount(). One sweep
+ * at the end keeps the IDs whose counter reached k.
+ *
+ * The operands are consumed whether or not evaluation succeeds.
+ */
+static FsStatus
+setThreshold (FsContext * ctx, Token * t, uint32 * opCnt, Set ** out)
+{
+  Set    * acc = NULL, * arg, * seen = NULL;
+  Set    * batch[NARY_BATCH];
+  uint32   batchCnt = 0;
+  char  ** pieces;
+  uint32   pieceCnt = 0;
+  char   * buf;
+  uint32   i, next = 0;
+  unsigned char tag = 0;
+  Load     ld;
+  char     k = t->threshold;
+  FsStatus status;
+
+  *out = NULL;
+
+  if ((pieces = ctxAlloc (ctx, sizeof(char *) * t->argCnt)) == NULL ||
+      (acc = setNew(ctx)) == NULL)
+  {
+    status = ctx->status;
+    goto fail;
+  }
+
+  memset(&ld, 0, sizeof(ld));
+  ld.fn      = countIds;
+  ld.rangeFn = countRange;
+  ld.acc     = acc;
+  ld.to  = k;
+
+  for (i = 0; i < t->argCnt; i++)
+  {
+    arg  = t->args[i];
+    next = i + 1;
+    operandPrefetch (t, next);
+
+    if (arg->type == SFILE)
+    {
+      pieces[pieceCnt++] = arg->x.file;
+      arg->x.file = NULL;
+      tokenFree (ctx, arg);
+
+      /* tags run out after MAX_GENERATION files; start over with a clean vector */
+      if (seen == NULL || tag == MAX_GENERATION)
+      {
+        if (seen != NULL)
+          setFree (ctx, seen);
+        if ((seen = setNew(ctx)) == NULL)
+        {
+          status = ctx->status;
+          goto fail;
+        }
+        tag  = 0;
+      }
+      ld.seen = seen;
+      ld.from = ++tag;
+      if ((status = fileParse (ctx, &ld, pieces[i], 0)) != FS_OK)
+        goto fail;
+      continue;
+    }
+
+    if ((status = nodeEval (ctx, arg, opCnt, &arg)) != FS_OK)
+      goto fail;
+    pieces[pieceCnt++] = arg->x.history;
+    arg->x.history = NULL;
+    setMaterialize (ctx, arg);
+    batch[batchCnt++] = arg;
+
+    if (batchCnt == NARY_BATCH)
+    {
+      setCount (ctx, acc, batch, batchCnt, k);
+      while (batchCnt > 0)
+        setFree (ctx, batch[--batchCnt]);
+    }
+  }
+
+  if (batchCnt > 0)
+  {
+    setCount (ctx, acc, batch, batchCnt, k);
+    while (batchCnt > 0)
+      setFree (ctx, batch[--batchCnt]);
+  }
+
+  if (seen != NULL)
+    setFree (ctx, seen);
+  seen = NULL;
+
+  setNormalize (ctx, acc, k);
+
+  buf = historyJoin (ctx, pieces, t->argCnt, 0);
+  pieceCnt = 0;
+  if (buf == NULL || (acc->x.history = ctxAlloc (ctx, strlen(buf) + 16)) == NULL)
+  {
+    ctxFree(ctx, buf);
+    status = ctx->status;
+    goto fail;
+  }
+  sprintf (acc->x.history, "( T %u %s )", t->threshold, buf);
+  ctxFree(ctx, buf);
+  ctxFree(ctx, pieces);
+
+  *out = acc;
+  return (FS_OK);
+
+fail:
+  for (i = next; i < t->argCnt; i++)
+    tokenTreeFree (ctx, t->args[i]);
+  while (batchCnt > 0)
+    setFree (ctx, batch[--batchCnt]);
+  while (pieceCnt > 0)
+    ctxFree (ctx, pieces[--pieceCnt]);
+  ctxFree (ctx, pieces);
+  if (seen != NULL)
+    setFree (ctx, seen);
+  if (acc != NULL)
+    setFree (ctx, acc);
+
+  return (status);
+}
+
+/*
+ * Evaluate the expression tree rooted at t into *out, a Set that
+ * replaces it. The tree is consumed whether or not evaluation
+ * succeeds.
+ */
+static FsStatus
+nodeEval (FsContext * ctx, Token * t, uint32 * opCnt, Set ** out)
+{
+  Set    * s = NULL;
+  FsStatus status;
+
+  *out = NULL;
+
+  if (t->type == SFILE && (status = setRead(ctx, t)) != FS_OK)
+  {
+    tokenTreeFree (ctx, t);
+    return (status);
+  }
+
+  if (t->type == SET)
+  {
+    *out = t;
+    return (FS_OK);
+  }
+
+  assert(t->type == OPERATOR);
+
+  if (t->x.operator == 'I')
+  {
+    status = nodeEval (ctx, t->args[0], opCnt, &s);
+    if (status == FS_OK)
+    {
+      if (ctx->verbose) fprintf (stderr, "%02d = ", *opCnt);
+      (*opCnt)++;
+      if ((status = setInvert (ctx, s)) != FS_OK)
+      {
+        setFree (ctx, s);
+        s = NULL;
+      }
+    }
+  }
+  else /* U, X, D, T */
+  {
+    if (t->x.operator == 'T')
+      status = setThreshold (ctx, t, opCnt, &s);
+    else
+      status = setCombine (ctx, t, opCnt, &s);
+    if (status == FS_OK)
+    {
+      if (ctx->verbose) fprintf (stderr, "%02d = %s\n", *opCnt, s->x.history);
+      (*opCnt)++;
+    }
+  }
+
+  tokenFree (ctx, t);
+
+  *out = s;
+  return (status);
+}
+
+/*
+ * Link the postfix tokens into an expression tree, returning its root.
+ * Chains of the same associative operator (f1 U f2 U ... U fn) are
+ * collapsed into one n-ary node as the tree is built, as are left
+ * nested differences (((f1 D f2) D f3) == f1 D (f2 U f3)), so that
+ * setCombine() can fold all of their operands in one go. On failure
+ * the tokens left on input are for the caller to free.
+ */
+static FsStatus
+exprTree (FsContext * ctx, Stack * input, Token ** root)
+{
+  Token * tok, * arg;
+  Stack * opStack;
+  Token ** args;
+  uint32  i, j, n, argCnt;
+  FsStatus status = FS_OK;
+
+  *root = NULL;
+
+  if ((opStack = stackNew(ctx)) == NULL)
+    return (ctx->status);
+
+  while (status == FS_OK && (tok = stackShift (input)) != NULL)
+  {
+    if (tok->type == OPERATOR)
+    {
+      /*
+       * Each operator takes a defined number of arguments. Err
+       * if there are fewer than the expected num on the stack.
+       */
+      argCnt = (tok->x.operator == 'T') ? tok->argCnt : op_arg_count(tok->x.operator);
+      if (stackDepth(opStack) < argCnt)
+      {
+        status = fsFail (ctx, FS_ESYNTAX, "insufficient values for the operator %c", (char) tok->x.operator);
+        tokenFree (ctx, tok);
+        break;
+      }
+
+      /* Else, Pop the top n values from the stack. */
+      if ((tok->args = ctxAlloc (ctx, sizeof(Token *) * argCnt)) == NULL)
+      {
+        status = ctx->status;
+        tokenFree (ctx, tok);
+        break;
+      }
+      tok->argCnt = argCnt;
+      for (i = argCnt; i > 0; i--)
+        tok->args[i - 1] = stackPop(opStack);
+
+      /* Splice the operands of a same-operator child into this node */
+      for (i = 0, n = 0; i < tok->argCnt; i++)
+      {
+        arg = tok->args[i];
+        if (op_splices(tok, arg, i))
+          n += arg->argCnt;
+        else
+          n++;
+      }
+
+      if (n != tok->argCnt)
+      {
+        if ((args = ctxAlloc (ctx, sizeof(Token *) * n)) == NULL)
+        {
+          status = ctx->status;
+          tokenTreeFree (ctx, tok);
+          break;
+        }
+
+        for (i = 0, n = 0; i < tok->argCnt; i++)
+        {
+          arg = tok->args[i];
+          if (op_splices(tok, arg, i))
+          {
+            for (j = 0; j < arg->argCnt; j++)
+              args[n++] = arg->args[j];
+            tokenFree (ctx, arg);
+          }
+          else
+            args[n++] = arg;
+        }
+
+        ctxFree(ctx, tok->args);
+        tok->args   = args;
+        tok->argCnt = n;
+      }
+    }
+
+    /* Push the linked node, or the value */
+    if ((status = stackPush(ctx, opStack, tok)) != FS_OK)
+      tokenTreeFree (ctx, tok);
+  }
+
+  /* If there is only one value in the stack,
+   * that value is the root of the expression.
+   * Anything but one value on the output stack is an error.
+   */
+  if (status == FS_OK)
+  {
+    if (stackDepth (opStack) == 1)
+      *root = stackPop (opStack);
+    else
+      status = fsFail (ctx, FS_ESYNTAX, "operands without an operator");
+  }
+
+  stackFree (ctx, opStack, TRUE);
+
+  return (status);
+}
+
+static FsStatus
+execute (FsContext * ctx, Stack * input, Set ** out)
+{
+  Token  * root;
+  uint32   opCnt = 0;
+  FsStatus status;
+
+  if ((status = exprTree (ctx, input, &root)) != FS_OK)
+    return (status);
+
+  return (nodeEval (ctx, root, &opCnt, out));
+}
+
+/* -------------------------------------------------------------------- */
+
+static Input *
+inputFind (Stack * inputs, const char * file)
+{
+  int32 i;
+
+  for (i = inputs->base; i <= inputs->depth; i++)
+    if (strcmp (((Input *) inputs->data[i])->file, file) == 0)
+      return (inputs->data[i]);
+
+  return (NULL);
+}
+
+static void
+inputsFree (FsContext * ctx, Stack * inputs)
+{
+  Input * in;
+
+  if (inputs == NULL)
+    return;
+
+  while ((in = stackPop (inputs)) != NULL)
+  {
+    ctxFree(ctx, in->file);
+    ctxFree(ctx, in);
+  }
+  stackFree (ctx, inputs, FALSE);
+}
+
+/*
+ * Record how far file has been parsed. A file named more than once
+ * in an expression keeps one record.
+ */
+static FsStatus
+inputNote (FsContext * ctx, const char * file, uint64 offset, struct stat * statBuf)
+{
+  Input * in;
+
+  if ((in = inputFind (ctx->inputs, file)) == NULL)
+  {
+    if ((in = ctxAlloc (ctx, sizeof(Input))) == NULL)
+      return (ctx->status);
+    if ((in->file = ctxStrdup (ctx, file)) == NULL || stackPush (ctx, ctx->inputs, in) != FS_OK)
+    {
+      ctxFree(ctx, in->file);
+      ctxFree(ctx, in);
+      return (ctx->status);
+    }
+  }
+
+  in->offset = offset;
+  in->dev    = statBuf->st_dev;
+  in->ino    = statBuf->st_ino;
+
+  return (FS_OK);
+}
+
+static void
+stateFree (FsContext * ctx, State * st)
+{
+  if (st == NULL)
+    return;
+
+  ctxFree(ctx, st->expr);
+  inputsFree (ctx, st->inputs);
+  if (st->result)
+    setFree (ctx, st->result);
+  ctxFree(ctx, st);
+}
+
+/*
+ * Load the state saved by stateSave() into *out, or leave it NULL if
+ * there is none or it can't be used.
+ *
+ * Format: a text header, one line per input file, then the result as
+ * a bit vector of max + 1 bits (ID i is bit i % 8 of byte i / 8).
+ *
+ *   filesets-state 1
+ *   max <max id>
+ *   expr <expression>
+ *   inputs <n>
+ *   <offset> <dev> <inode> <path>      (n lines)
+ *   result
+ */
+static FsStatus
+stateLoad (FsContext * ctx, const char * path, State ** out)
+{
+  FILE   * fp;
+  State  * st;
+  Input  * in;
+  char   * line = NULL;
+  size_t   lineSize = 0;
+  ssize_t  len;
+  int      n, pos;
+  uint64   i;
+  int      c;
+  FsStatus status = FS_OK;
+
+  *out = NULL;
+
+  if ((fp = fopen (path, "r")) == NULL)
+    return (FS_OK);
+
+  if ((st = ctxAlloc (ctx, sizeof(State))) == NULL)
+  {
+    fclose(fp);
+    return (ctx->status);
+  }
+  memset(st, 0, sizeof(State));
+  if ((st->inputs = stackNew(ctx)) == NULL)
+    goto fail;
+
+  if (getline (&line, &lineSize, fp) < 0 || strcmp (line, "filesets-state 1\n") != 0)
+    goto bad;
+  if (getline (&line, &lineSize, fp) < 0 || sscanf (line, "max %u", &st->max) != 1)
+    goto bad;
+  if ((len = getline (&line, &lineSize, fp)) < 5 || strncmp (line, "expr ", 5) != 0)
+    goto bad;
+  line[len - 1] = '\0';
+  if ((st->expr = ctxStrdup (ctx, line + 5)) == NULL)
+    goto fail;
+  if (getline (&line, &lineSize, fp) < 0 || sscanf (line, "inputs %d", &n) != 1)
+    goto bad;
+
+  while (n-- > 0)
+  {
+    if ((len = getline (&line, &lineSize, fp)) < 0)
+      goto bad;
+    line[len - 1] = '\0';
+
+    if ((in = ctxAlloc (ctx, sizeof(Input))) == NULL)
+      goto fail;
+    if (sscanf (line, "%lu %lu %lu %n", &in->offset, &in->dev, &in->ino, &pos) != 3)
+    {
+      ctxFree(ctx, in);
+      goto bad;
+    }
+    if ((in->file = ctxStrdup (ctx, line + pos)) == NULL || stackPush (ctx, st->inputs, in) != FS_OK)
+    {
+      ctxFree(ctx, in->file);
+      ctxFree(ctx, in);
+      goto fail;
+    }
+  }
+
+  if (getline (&line, &lineSize, fp) < 0 || strcmp (line, "result\n") != 0)
+    goto bad;
+
+  if (st->max == ctx->max)
+  {
+    if ((st->result = setNew(ctx)) == NULL)
+      goto fail;
+    for (i = 0; i <= ctx->max; i += 8)
+    {
+      if ((c = getc (fp)) == EOF)
+        goto bad;
+      for (n = 0; n < 8 && i + n <= ctx->max; n++)
+        st->result->vector[i + n] = (c >> n) & 1;
+    }
+  }
+
+  free(line);
+  fclose(fp);
+  *out = st;
+  return (FS_OK);
+
+fail:
+  status = ctx->status;
+  goto done;
+
+bad:
+  if (ctx->verbose) fprintf (stderr, "incremental: ignoring unreadable state file %s\n", path);
+
+done:
+  stateFree (ctx, st);
+  free(line);
+  fclose(fp);
+  return (status);
+}
+
+/*
+ * Save the inputs parsed by this run and its result, for the next
+ * incremental run. The file is written beside path and renamed into
+ * place so an interrupted run leaves the previous state intact.
+ */
+static FsStatus
+stateSave (FsContext * ctx, const char * path, const char * expr, Set * result)
+{
+  FILE   * fp;
+  Input  * in;
+  char   * tmp;
+  uint64   i;
+  int32    n;
+  int      c;
+
+  if ((tmp = ctxAlloc (ctx, strlen(path) + 5)) == NULL)
+    return (ctx->status);
+  sprintf (tmp, "%s.tmp", path);
+
+  if ((fp = fopen (tmp, "w")) == NULL)
+  {
+    fsFail (ctx, FS_EIO, "can't open state file: %s", tmp);
+    ctxFree(ctx, tmp);
+    return (FS_EIO);
+  }
+
+  fprintf (fp, "filesets-state 1\n");
+  fprintf (fp, "max %u\n", ctx->max);
+  fprintf (fp, "expr %s\n", expr);
+  fprintf (fp, "inputs %d\n", stackDepth(ctx->inputs));
+  for (n = ctx->inputs->base; n <= ctx->inputs->depth; n++)
+  {
+    in = ctx->inputs->data[n];
+    fprintf (fp, "%lu %lu %lu %s\n", in->offset, in->dev, in->ino, in->file);
+  }
+  fprintf (fp, "result\n");
+
+  setMaterialize (ctx, result);
+  for (i = 0; i <= ctx->max; i += 8)
+  {
+    for (n = 0, c = 0; n < 8 && i + n <= ctx->max; n++)
+      c |= (result->vector[i + n] != 0) << n;
+    putc (c, fp);
+  }
+
+  if (fclose (fp) != 0 || rename (tmp, path) != 0)
+  {
+    fsFail (ctx, FS_EIO, "can't write state file: %s", path);
+    ctxFree(ctx, tmp);
+    return (FS_EIO);
+  }
+  ctxFree(ctx, tmp);
+
+  return (FS_OK);
+}
+
+/*
+ * Fold the delta of a child into the running delta of its parent.
+ */
+static void
+changeMerge (FsContext * ctx, Change * acc, Change * c)
+{
+  Set * sets[1];
+
+  if (acc->delta == NULL)
+    acc->delta = c->delta;
+  else
+  {
+    sets[0] = c->delta;
+    setFold (ctx, acc->delta, 'U', sets, 1);
+    setFree (ctx, c->delta);
+  }
+  c->delta = NULL;
+}
+
+static void
+changeFree (FsContext * ctx, Change * c)
+{
+  if (c->delta)
+    setFree (ctx, c->delta);
+  c->delta = NULL;
+}
+
+/*
+ * Work out how the set of node t changed since the run that saved st,
+ * given that input files only grow. The rules keep delta exact: a node
+ * reported ADDED now holds its old set plus delta, REMOVED its old set
+ * minus delta.
+ *
+ *   leaf   appended lines                         -> ADDED
+ *   U      children only ADDED                    -> ADDED (union of deltas)
+ *   X      children only REMOVED                  -> REMOVED (union of deltas)
+ *   D      first child REMOVED or unchanged,
+ *          the rest only ADDED                    -> REMOVED (union of deltas)
+ *   I      swaps ADDED and REMOVED
+ *   T      any change                             -> RECOMPUTE
+ *
+ * Anything else (a union losing IDs, an intersection or the left side
+ * of a difference gaining them, a truncated or replaced file, a binary
+ * set file that changed at all) needs the operands themselves, so it's reported as RECOMPUTE. On failure *c
+ * holds nothing.
+ */
+static FsStatus
+nodeChange (FsContext * ctx, Token * t, State * st, Change * c)
+{
+  Change       arg;
+  Input      * in;
+  struct stat  statBuf;
+  uint32       i;
+  ChangeType   want;
+  FsStatus     status;
+
+  memset(c, 0, sizeof(*c));
+
+  if (t->type == SFILE)
+  {
+    in = inputFind (st->inputs, t->x.file);
+    if (in == NULL || stat (t->x.file, &statBuf) < 0 ||
+        statBuf.st_dev != in->dev || statBuf.st_ino != in->ino ||
+        statBuf.st_size < (off_t) in->offset)
+    {
+      if (ctx->verbose) fprintf (stderr, "incremental: %s changed other than by appending\n", t->x.file);
+      c->type = RECOMPUTE;
+      return (FS_OK);
+    }
+
+    if (statBuf.st_size == (off_t) in->offset)
+      return (inputNote (ctx, t->x.file, in->offset, &statBuf));
+
+    if (fsFileIsBinary (t->x.file))
+    {
+      if (ctx->verbose) fprintf (stderr, "incremental: binary set file %s changed\n", t->x.file);
+      c->type = RECOMPUTE;
+      return (FS_OK);
+    }
+
+    c->type = ADDED;
+    if ((c->delta = setNew(ctx)) == NULL)
+      return (ctx->status);
+    if ((status = setReadMark (ctx, c->delta, t->x.file, in->offset, 0, 1)) != FS_OK)
+      changeFree (ctx, c);
+    return (status);
+  }
+
+  assert(t->type == OPERATOR);
+
+  if (t->x.operator == 'I')
+  {
+    status = nodeChange (ctx, t->args[0], st, c);
+    if (c->type == ADDED)
+      c->type = REMOVED;
+    else if (c->type == REMOVED)
+      c->type = ADDED;
+    return (status);
+  }
+
+  for (i = 0; i < t->argCnt; i++)
+  {
+    if ((status = nodeChange (ctx, t->args[i], st, &arg)) != FS_OK)
+    {
+      changeFree (ctx, c);
+      return (status);
+    }
+    if (arg.type == UNCHANGED)
+      continue;
+
+    switch (t->x.operator)
+    {
+      case 'U':  want = ADDED;                          break;
+      case 'X':  want = REMOVED;                        break;
+      case 'D':  want = (i == 0) ? REMOVED : ADDED;     break;
+      default:   want = RECOMPUTE;                      break;
+    }
+
+    if (arg.type != want || want == RECOMPUTE)
+    {
+      changeFree (ctx, &arg);
+      changeFree (ctx, c);
+      c->type = RECOMPUTE;
+      return (FS_OK);
+    }
+
+    c->type = (t->x.operator == 'U') ? ADDED : REMOVED;
+    changeMerge (ctx, c, &arg);
+  }
+
+  return (FS_OK);
+}
+
+/*
+ * Collapse all whitespace runs to single spaces, so that the saved
+ * expression compares equal however it was laid out.
+ */
+static char *
+exprNormalize (char * expr)
+{
+  char * src, * dst;
+
+  for (src = dst = expr; *src; src++)
+    if (strchr (" \t\r\n", *src) == NULL)
+      *dst++ = *src;
+    else if (dst > expr && dst[-1] != ' ')
+      *dst++ = ' ';
+  if (dst > expr && dst[-1] == ' ')
+    dst--;
+  *dst = '\0';
+
+  return (expr);
+}
+
+/* A new set holding a's members, less b's if b isn't NULL */
+static Set *
+setMinus (FsContext * ctx, Set * a, Set * b)
+{
+  Set * s;
+
+  if ((s = setNew(ctx)) == NULL)
+    return (NULL);
+  if (a != NULL)
+    setFold (ctx, s, 'U', &a, 1);
+  if (b != NULL)
+    setFold (ctx, s, 'D', &b, 1);
+  return (s);
+}
+
+/* -------------------------------------------------------------------- */
+
+/*
+ * The most set vectors evaluating t keeps at once, following nodeEval():
+ * an n-ary node holds its accumulator and up to NARY_BATCH evaluated
+ * operands while it evaluates the next, and a threshold also holds the
+ * vector that tags its files. *complement is whether t's result is
+ * complemented, which decides whether setCombine() can mark a file
+ * straight into it.
+ */
+static uint64
+exprPeak (Token * t, boolean * complement)
+{
+  boolean  c, accComplement = FALSE;
+  uint64   peak, live;
+  uint32   i, held = 0, seen = 0;
+
+  *complement = FALSE;
+  if (t->type != OPERATOR)
+    return (1);
+
+  if (t->x.operator == 'I')
+  {
+    peak = exprPeak (t->args[0], &c);
+    *complement = ! c;
+    return (peak);
+  }
+
+  if (t->x.operator == 'T')
+    peak = 1;
+  else
+  {
+    peak = exprPeak (t->args[0], &accComplement);
+    *complement = accComplement;
+  }
+
+  for (i = (t->x.operator == 'T') ? 0 : 1; i < t->argCnt; i++)
+  {
+    if (t->args[i]->type == SFILE && ! (accComplement && t->x.operator == 'X'))
+    {
+      seen = (t->x.operator == 'T');
+      live = 1 + seen + held;
+    }
+    else
+    {
+      live = 1 + seen + held + exprPeak (t->args[i], &c);
+      if (++held == NARY_BATCH)
+        held = 0;
+    }
+    if (live > peak)
+      peak = live;
+  }
+
+  return (peak);
+}
+
+/* Write out the buffer of open partition i */
+static void
+partitionFlush (Partition * pt, uint64 i)
+{
+  if (pt->len[i] > 0 && write (pt->fds[i], pt->buf + i * PARTITION_BUFFER, pt->len[i]) != (ssize_t) pt->len[i])
+    pt->failed = TRUE;
+  pt->len[i] = 0;
+}
+
+/* Append the line "first-last", or just "first" for a run of one, to open partition i */
+static void
+partitionLine (Partition * pt, uint64 i, uint64 first, uint64 last)
+{
+  char * p;
+
+  if (pt->len[i] > PARTITION_BUFFER - WRITE_LINE)
+    partitionFlush (pt, i);
+  p = idFormat (pt->buf + i * PARTITION_BUFFER + pt->len[i], first);
+  if (first != last)
+  {
+    *p++ = '-';
+    p    = idFormat (p, last);
+  }
+  *p++ = '\n';
+  pt->len[i] = p - (pt->buf + i * PARTITION_BUFFER);
+}
+
+/* Append each ID of the open passes to the partition of its pass, as an ID of that pass */
+static void
+partitionIds (Load * ld, uint32 * ids, uint32 n)
+{
+  Partition * pt = ld->arg;
+  uint64      k;
+  uint32      i;
+
+  for (i = 0; i < n; i++)
+  {
+    k = (ids[i] - 1) / pt->span;
+    if (k - pt->first < pt->cnt)
+      partitionLine (pt, k - pt->first, ids[i] - k * pt->span, ids[i] - k * pt->span);
+  }
+}
+
+/* Append a range to the partitions of the open passes it spans, split at their edges */
+static void
+partitionRange (Load * ld, uint32 first, uint32 last)
+{
+  Partition * pt = ld->arg;
+  uint64      id, end, k;
+  uint64      lo = pt->first * pt->span + 1, hi = (pt->first + pt->cnt) * pt->span;
+
+  for (id = (first > lo) ? first : lo; id <= last && id <= hi; id = end + 1)
+  {
+    k   = (id - 1) / pt->span;
+    end = ((k + 1) * pt->span < last) ? (k + 1) * pt->span : last;
+    partitionLine (pt, k - pt->first, id - k * pt->span, end - k * pt->span);
+  }
+}
+
+/* The path of the partition of input file f for pass k */
+static void
+partitionPath (char * path, const char * dir, uint32 f, uint64 k)
+{
+  snprintf (path, PATH_MAX, "%s/%u.%lu", dir, f, k);
+}
+
+/* Write the stage's result, on the stage's thread */
+static void *
+stageThread (void * arg)
+{
+  Stage * st = arg;
+
+  st->status = fsSetWrite (&st->ctx, st->s, st->fp, st->format);
+  return (NULL);
+}
+
+/* Start writing s, the result of pass, while the caller goes on */
+static void
+stageStart (FsContext * ctx, Stage * st, Set * s, Pass * pass, FILE * fp, FsFormat format)
+{
+  st->ctx      = *ctx;
+  st->ctx.pass = pass;
+  st->s        = s;
+  st->fp       = fp;
+  st->format   = format;
+  st->status   = FS_OK;
+  st->threaded = (pthread_create (&st->thread, NULL, stageThread, st) == 0);
+  if ( ! st->threaded)
+    stageThread (st);
+}
+
+/* Wait for the stage's result to be written, and free it */
+static FsStatus
+stageFinish (FsContext * ctx, Stage * st)
+{
+  if (st->s == NULL)
+    return (FS_OK);
+  if (st->threaded)
+    pthread_join (st->thread, NULL);
+  setFree (&st->ctx, st->s);
+  st->s = NULL;
+
+  if (st->status != FS_OK)
+    return (fsFail (ctx, st->status, "%s", st->ctx.message));
+  return (FS_OK);
+}
+
+/*
+ * Passes split per read of an input: as many as can be open at once,
+ * leaving the caller half its descriptors, up to PARTITION_FILES
+ */
+static uint64
+partitionBatch (uint64 passes)
+{
+  struct rlimit nofile;
+  uint64        batch = PARTITION_FILES;
+
+  if (getrlimit (RLIMIT_NOFILE, &nofile) == 0 && nofile.rlim_cur != RLIM_INFINITY && nofile.rlim_cur / 2 < batch)
+    batch = (nofile.rlim_cur / 2 > 0) ? nofile.rlim_cur / 2 : 1;
+  return (passes < batch ? passes : batch);
+}
+
+/*
+ * Evaluate expr and write it to fp in passes over ranges of span IDs,
+ * for when the whole range needs more memory than the limit. Each input
+ * file is first split into a partition per pass, holding its IDs in
+ * that range as IDs from 1 to span (read again for each batch of
+ * passes whose partitions can be open at once, up to PARTITION_FILES).
+ * Each pass then evaluates expr over the partitions with max set to
+ * span, as if the range were the whole ID space (so a complement or a
+ * threshold works within it), and writes the result offset by the start
+ * of the range. Passes go in ID order, so the output is in order, and a
+ * run of IDs written as a range may go on from one pass into the next.
+ *
+ * Evaluating, formatting and writing are pipelined by range: while
+ * pass k is loaded and evaluated, the format stage formats pass k - 1's
+ * result and the writer thread writes what is already formatted. That
+ * holds one result vector beyond the expression's own (fsEvalWrite()
+ * budgets for it).
+ */
+static FsStatus
+evalPasses (FsContext * ctx, const char * expr, FILE * fp, FsFormat format, uint64 span, uint64 passes)
+{
+  Stack    * postfix = NULL;
+  Token    * t;
+  Set      * s;
+  Partition  pt;
+  Pass       pass;
+  Stage      stage;
+  Writer     writer;
+  Load       ld;
+  const char * tmp;
+  char       dir[PATH_MAX], path[PATH_MAX];
+  char    ** files = NULL;
+  uint32   * fileOf = NULL;
+  uint32     fileCnt = 0, tokCnt = 0, f, j;
+  uint64     batch = partitionBatch (passes);
+  uint32     max = ctx->max;
+  uint64     k;
+  int32      n;
+  FsStatus   status = FS_OK, closed;
+
+  memset(&pt, 0, sizeof(pt));
+  pt.span = span;
+  dir[0] = '\0';
+
+  /* the distinct input files, and which of them each file token names */
+  if ((postfix = stackNew(ctx)) == NULL)
+    return (ctx->status);
+  if ((status = convertToPostfix (ctx, expr, postfix)) != FS_OK)
+    goto done;
+  if ((files = ctxAlloc (ctx, sizeof(char *) * (stackDepth(postfix) + 1))) == NULL ||
+      (fileOf = ctxAlloc (ctx, sizeof(uint32) * (stackDepth(postfix) + 1))) == NULL ||
+      (pt.fds = ctxAlloc (ctx, sizeof(int) * batch)) == NULL ||
+      (pt.len = ctxAlloc (ctx, sizeof(uint32) * batch)) == NULL ||
+      (pt.buf = ctxAlloc (ctx, (uint64) PARTITION_BUFFER * batch)) == NULL)
+  {
+    status = ctx->status;
+    goto done;
+  }
+  for (k = 0; k < batch; k++)
+  {
+    pt.fds[k] = -1;
+    pt.len[k] = 0;
+  }
+  for (n = postfix->base; n <= postfix->depth; n++)
+  {
+    t = postfix->data[n];
+    if (t->type != SFILE)
+      continue;
+    for (f = 0; f < fileCnt && strcmp (files[f], t->x.file) != 0; f++)
+      ;
+    if (f == fileCnt)
+      files[fileCnt++] = t->x.file;
+    fileOf[tokCnt++] = f;
+  }
+
+  if ((tmp = getenv ("TMPDIR")) == NULL || *tmp == '\0')
+    tmp = "/tmp";
+  snprintf (dir, sizeof(dir), "%s/filesets-XXXXXX", tmp);
+  if (mkdtemp (dir) == NULL)
+  {
+    status = fsFail (ctx, FS_EIO, "can't make a directory for partitions in %s", tmp);
+    dir[0] = '\0';
+    goto done;
+  }
+
+  if (ctx->verbose)
+    fprintf (stderr, "passes: %lu of %lu IDs, %u files partitioned in %s\n", passes, span, fileCnt, dir);
+
+  /* split each input, batch passes per read */
+  memset(&ld, 0, sizeof(ld));
+  ld.fn      = partitionIds;
+  ld.rangeFn = partitionRange;
+  ld.arg     = &pt;
+  for (f = 0; f < fileCnt && status == FS_OK; f++)
+    for (pt.first = 0; pt.first < passes && status == FS_OK; pt.first += pt.cnt)
+    {
+      pt.cnt = (passes - pt.first < batch) ? passes - pt.first : batch;
+      if (f + 1 < fileCnt && pt.first + pt.cnt == passes)
+        filePrefetch (files[f + 1]);
+      for (k = 0; k < pt.cnt; k++)
+      {
+        partitionPath (path, dir, f, pt.first + k);
+        if ((pt.fds[k] = open (path, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0)
+        {
+          status = fsFail (ctx, FS_EIO, "can't open partition %s", path);
+          break;
+        }
+      }
+      if (status == FS_OK)
+        status = fileParse (ctx, &ld, files[f], 0);
+      for (k = 0; k < pt.cnt; k++)
+      {
+        if (pt.fds[k] >= 0)
+        {
+          partitionFlush (&pt, k);
+          if (close (pt.fds[k]) != 0)
+            pt.failed = TRUE;
+        }
+        pt.fds[k] = -1;
+      }
+      if (pt.failed && status == FS_OK)
+        status = fsFail (ctx, FS_EIO, "can't write partitions of %s in %s", files[f], dir);
+    }
+  if (status != FS_OK)
+    goto done;
+
+  if ((status = writerOpen (ctx, fp, &writer)) != FS_OK)
+    goto done;
+  memset(&pass, 0, sizeof(pass));
+  memset(&stage, 0, sizeof(stage));
+  pass.writer = &writer;
+
+  for (k = 0; k < passes && status == FS_OK; k++)
+  {
+    ctx->max = (max - k * span < span) ? max - k * span : span;
+
+    stackFree (ctx, postfix, TRUE);
+    if ((postfix = stackNew(ctx)) == NULL)
+    {
+      status = ctx->status;
+      break;
+    }
+    if ((status = convertToPostfix (ctx, expr, postfix)) != FS_OK)
+      break;
+    for (n = postfix->base, j = 0; n <= postfix->depth; n++)
+    {
+      t = postfix->data[n];
+      if (t->type != SFILE)
+        continue;
+      partitionPath (path, dir, fileOf[j++], k);
+      ctxFree (ctx, t->x.file);
+      if ((t->x.file = ctxStrdup (ctx, path)) == NULL)
+      {
+        status = ctx->status;
+        break;
+      }
+    }
+    if (status != FS_OK || (status = execute (ctx, postfix, &s)) != FS_OK)
+      break;
+
+    /* the last pass's result is written by now, so the pass can move on */
+    if ((status = stageFinish (ctx, &stage)) != FS_OK)
+    {
+      setFree (ctx, s);
+      break;
+    }
+    pass.base = k * span;
+    stageStart (ctx, &stage, s, &pass, fp, format);
+  }
+
+  if ((closed = stageFinish (ctx, &stage)) != FS_OK && status == FS_OK)
+    status = closed;
+  if (status == FS_OK && pass.runLast != 0)
+    writerRange (&writer, pass.runFirst, pass.runLast);
+  if ((closed = writerClose (ctx, &writer)) != FS_OK && status == FS_OK)
+    status = closed;
+
+done:
+  ctx->max  = max;
+  ctx->pass = NULL;
+  if (dir[0] != '\0')
+  {
+    for (f = 0; f < fileCnt; f++)
+      for (k = 0; k < passes; k++)
+      {
+        partitionPath (path, dir, f, k);
+        unlink (path);
+      }
+    rmdir (dir);
+  }
+  stackFree (ctx, postfix, TRUE);
+  ctxFree (ctx, pt.buf);
+  ctxFree (ctx, pt.len);
+  ctxFree (ctx, pt.fds);
+  ctxFree (ctx, fileOf);
+  ctxFree (ctx, files);
+
+  return (status);
+}
+
+/* -------------------------------------------------------------------- */
+
+FsStatus
+fsContextNew (FsContext ** out, uint32_t maxId, const FsAllocator * alloc)
+{
+  FsContext   * ctx;
+  FsAllocator   a;
+
+  *out = NULL;
+
+  if (alloc != NULL)
+    a = *alloc;
+  else
+  {
+    a.alloc   = defaultAlloc;
+    a.realloc = defaultRealloc;
+    a.free    = defaultFree;
+    a.arg     = NULL;
+  }
+
+  if (maxId == 0 || maxId == UINT_MAX || a.alloc == NULL || a.realloc == NULL || a.free == NULL)
+    return (FS_EINVAL);
+
+  if ((ctx = a.alloc (a.arg, sizeof(FsContext))) == NULL)
+    return (FS_ENOMEM);
+
+  memset(ctx, 0, sizeof(FsContext));
+  ctx->max         = maxId;
+  ctx->threads     = 1;
+  ctx->hugePages   = TRUE;
+  ctx->alloc       = a;
+  ctx->customAlloc = (alloc != NULL);
+
+  *out = ctx;
+  return (FS_OK);
+}
+
+void
+fsContextFree (FsContext * ctx)
+{
+  if (ctx)
+    ctx->alloc.free (ctx->alloc.arg, ctx);
+}
+
+uint32_t
+fsContextMax (const FsContext * ctx)
+{
+  return (ctx->max);
+}
+
+FsStatus
+fsContextThreads (FsContext * ctx, uint32_t threads)
+{
+  if (threads < 1 || threads > MAX_THREADS)
+    return (fsFail (ctx, FS_EINVAL, "threads must be between 1 and %d", MAX_THREADS));
+
+  ctx->threads = threads;
+  return (FS_OK);
+}
+
+void
+fsContextHugePages (FsContext * ctx, int on)
+{
+  ctx->hugePages = (on != 0);
+}
+
+void
+fsContextVerbose (FsContext * ctx, int on)
+{
+  ctx->verbose = (on != 0);
+}
+
+void
+fsContextSeed (FsContext * ctx, uint64_t seed)
+{
+  ctx->rng    = seed;
+  ctx->seeded = TRUE;
+}
+
+const char *
+fsErrorMessage (const FsContext * ctx)
+{
+  return (ctx->message);
+}
+
+const char *
+fsStatusName (FsStatus status)
+{
+  switch (status)
+  {
+    case FS_OK:       return "ok";
+    case FS_ENOMEM:   return "out of memory";
+    case FS_EIO:      return "I/O error";
+    case FS_ERANGE:   return "ID out of range";
+    case FS_ESYNTAX:  return "syntax error";
+    case FS_EINVAL:   return "invalid argument";
+  }
+  return "unknown error";
+}
+
+void
+fsFree (FsContext * ctx, void * p)
+{
+  ctxFree (ctx, p);
+}
+
+/* -------------------------------------------------------------------- */
+
+FsStatus
+fsSetNew (FsContext * ctx, FsSet ** set)
+{
+  Set * s;
+
+  *set = NULL;
+  if ((s = setNew(ctx)) == NULL)
+    return (ctx->status);
+  if ((s->x.history = ctxStrdup(ctx, "set")) == NULL)
+  {
+    setFree (ctx, s);
+    return (ctx->status);
+  }
+
+  *set = s;
+  return (FS_OK);
+}
+
+FsStatus
+fsSetLoad (FsContext * ctx, const char * file, FsSet ** set)
+{
+  Token  * t;
+  FsStatus status;
+
+  *set = NULL;
+  if ((t = tokenNew(ctx)) == NULL)
+    return (ctx->status);
+  t->type = SFILE;
+  if ((t->x.file = ctxStrdup(ctx, file)) == NULL)
+  {
+    tokenFree (ctx, t);
+    return (ctx->status);
+  }
+
+  if ((status = setRead (ctx, t)) != FS_OK)
+  {
+    tokenTreeFree (ctx, t);
+    return (status);
+  }
+
+  *set = t;
+  return (FS_OK);
+}
+
+FsStatus
+fsSetFromIds (FsContext * ctx, const uint32_t * ids, uint64_t n, FsSet ** set)
+{
+  Set    * s;
+  uint64   i;
+  FsStatus status;
+
+  *set = NULL;
+  if ((status = fsSetNew (ctx, &s)) != FS_OK)
+    return (status);
+
+  for (i = 0; i < n; i++)
+  {
+    if (ids[i] == 0 || ids[i] > ctx->max)
+    {
+      setFree (ctx, s);
+      return (fsFail (ctx, FS_ERANGE, "ID %u is outside 1..%u", ids[i], ctx->max));
+    }
+    s->vector[ids[i]] = 1;
+  }
+
+  *set = s;
+  return (FS_OK);
+}
+
+FsStatus
+fsSetCopy (FsContext * ctx, const FsSet * s, FsSet ** set)
+{
+  Set * c;
+
+  *set = NULL;
+  if ((c = setNew(ctx)) == NULL)
+    return (ctx->status);
+  if ((c->x.history = ctxStrdup(ctx, s->x.history)) == NULL)
+  {
+    setFree (ctx, c);
+    return (ctx->status);
+  }
+  memcpy (c->vector, s->vector, (uint64) ctx->max + 1);
+  c->complement = s->complement;
+
+  *set = c;
+  return (FS_OK);
+}
+
+void
+fsSetFree (FsContext * ctx, FsSet * s)
+{
+  if (s)
+    setFree (ctx, s);
+}
+
+FsStatus
+fsSetFold (FsContext * ctx, FsSet * acc, char op, FsSet * const * sets, uint32_t n)
+{
+  if (op != 'U' && op != 'X' && op != 'D')
+    return (fsFail (ctx, FS_EINVAL, "operator must be U, X or D, not %c", op));
+
+  if (n > 0)
+  {
+    setRankClear (ctx, acc);
+    setFold (ctx, acc, op, (Set **) sets, n);
+  }
+  return (FS_OK);
+}
+
+FsStatus
+fsSetInvert (FsContext * ctx, FsSet * s)
+{
+  return (setInvert (ctx, s));
+}
+
+uint64_t
+fsSetCount (FsContext * ctx, const FsSet * s)
+{
+  return (setSize (ctx, s));
+}
+
+/*
+ * Copy up to n members, from ID *cursor on (start at 1), to ids in
+ * ascending order, leaving *cursor at the next ID to look at. Returns
+ * how many were copied; 0 once the set is exhausted.
+ */
+uint64_t
+fsSetIds (FsContext * ctx, const FsSet * s, uint32_t * cursor, uint32_t * ids, uint64_t n)
+{
+  uint64 * w = (uint64 *) s->vector;
+  uint64   id = (*cursor > 0) ? *cursor : 1;
+  uint64   cnt = 0;
+  uint64   none = s->complement ? 0x0101010101010101UL : 0;
+
+  while (id <= ctx->max && cnt < n)
+  {
+    /* skip words without members whole */
+    if (id % sizeof(uint64) == 0 && id / sizeof(uint64) < vectorWords(ctx) && w[id / sizeof(uint64)] == none)
+    {
+      id += sizeof(uint64);
+      continue;
+    }
+    if (s->vector[id] != s->complement)
+      ids[cnt++] = id;
+    id++;
+  }
+
+  *cursor = (id <= ctx->max) ? id : (uint64) ctx->max + 1;
+  return (cnt);
+}
+
+FsStatus
+fsSetShuffle (FsContext * ctx, const FsSet * s, uint32_t ** ids, uint64_t * n)
+{
+  uint64   cnt;
+  FsStatus status;
+
+  status = setShuffle (ctx, s, ids, &cnt);
+  *n = cnt;
+  return (status);
+}
+
+/*
+ * Output goes through a writer: the pass's during fsEvalWrite()
+ * passes, otherwise one of this call's own.
+ */
+FsStatus
+fsSetWrite (FsContext * ctx, FsSet * s, FILE * fp, FsFormat format)
+{
+  Writer   own, * w = ctx->pass ? ctx->pass->writer : &own;
+  FsStatus status = FS_OK, closed;
+
+  setMaterialize (ctx, s);
+  if (format < FS_FORMAT_IDS || format > FS_FORMAT_BINARY)
+    return (fsFail (ctx, FS_EINVAL, "unknown output format %d", format));
+
+  if (w == &own && (status = writerOpen (ctx, fp, w)) != FS_OK)
+    return (status);
+  switch (format)
+  {
+    case FS_FORMAT_IDS:       setWrite (ctx, s, w, 0);                    break;
+    case FS_FORMAT_RANGES:    setWriteRanges (ctx, s, w);                 break;
+    case FS_FORMAT_SHUFFLED:  status = setShuffleAndWrite (ctx, s, w);    break;
+    case FS_FORMAT_ADDED:     setWrite (ctx, s, w, '+');                  break;
+    case FS_FORMAT_REMOVED:   setWrite (ctx, s, w, '-');                  break;
+    case FS_FORMAT_BINARY:    status = setWriteBinary (ctx, s, w);        break;
+  }
+  if (w == &own && (closed = writerClose (ctx, w)) != FS_OK && status == FS_OK)
+    status = closed;
+
+  return (status);
+}
+
+const char *
+fsSetHistory (const FsSet * s)
+{
+  return (s->x.history);
+}
+
+/* -------------------------------------------------------------------- */
+
+FsStatus
+fsWriterOpen (FsContext * ctx, FILE * fp, FsWriter ** w)
+{
+  Writer * nw;
+  FsStatus status;
+
+  if ((nw = ctxAlloc (ctx, sizeof(Writer))) == NULL)
+    return (ctx->status);
+  if ((status = writerOpen (ctx, fp, nw)) != FS_OK)
+  {
+    ctxFree (ctx, nw);
+    return (status);
+  }
+  *w = nw;
+  return (FS_OK);
+}
+
+void
+fsWriterText (FsWriter * w, const char * text)
+{
+  writerBytes (w, text, strlen (text));
+}
+
+void
+fsWriterNumber (FsWriter * w, uint64_t n)
+{
+  if (w->pos > w->end)
+    writerFlush (w);
+  w->pos = idFormat (w->pos, n);
+}
+
+void
+fsWriterIds (FsWriter * w, const uint32_t * ids, uint64_t n)
+{
+  uint64 i;
+
+  for (i = 0; i < n; i++)
+    writerId (w, 0, ids[i]);
+}
+
+FsStatus
+fsWriterClose (FsContext * ctx, FsWriter * w)
+{
+  FsStatus status = writerClose (ctx, w);
+
+  ctxFree (ctx, w);
+  return (status);
+}
+
+/* -------------------------------------------------------------------- */
+
+FsStatus
+fsSetRank (FsContext * ctx, FsSet * s, uint32_t id, uint64_t * rank)
+{
+  View     v;
+  FsStatus status;
+
+  if ((status = setView (ctx, s, &v)) != FS_OK)
+    return (status);
+  *rank = viewRank (&v, id);
+  return (FS_OK);
+}
+
+FsStatus
+fsSetSelect (FsContext * ctx, FsSet * s, uint64_t k, uint32_t * id)
+{
+  View     v;
+  FsStatus status;
+
+  if ((status = setView (ctx, s, &v)) != FS_OK)
+    return (status);
+  if (k >= v.count)
+    return (fsFail (ctx, FS_ERANGE, "offset %lu is past the last of %lu IDs", k, v.count));
+  *id = viewSelect (&v, k);
+  return (FS_OK);
+}
+
+FsStatus
+fsSetWritePage (FsContext * ctx, FsSet * s, FILE * fp, FsFormat format,
+                uint32_t first, uint32_t last, uint64_t offset, uint64_t limit)
+{
+  View     v;
+  FsStatus status;
+
+  if ((status = setView (ctx, s, &v)) != FS_OK)
+    return (status);
+  return (viewWritePage (ctx, &v, fp, format, first, last, offset, limit));
+}
+
+FsStatus
+fsOverlap (FsContext * ctx, const char * const * files, uint32_t n, uint64_t * counts)
+{
+  return (overlap (ctx, files, n, counts));
+}
+
+void
+fsShuffleIds (FsContext * ctx, uint32_t * ids, uint64_t n)
+{
+  idsShuffle (ctx, ids, n);
+}
+
+FsStatus
+fsSetSample (FsContext * ctx, FsSet * s, uint64_t k, uint32_t strata, uint32_t ** ids, uint64_t * n)
+{
+  View     v;
+  FsStatus status;
+
+  *ids = NULL;
+  *n   = 0;
+  if ((status = setView (ctx, s, &v)) != FS_OK)
+    return (status);
+  return (viewSample (ctx, &v, k, strata, ids, n));
+}
+
+FsStatus
+fsFileSample (FsContext * ctx, const char * file, uint64_t k, uint32_t strata, uint32_t ** ids, uint64_t * n)
+{
+  View     v;
+  FsStatus status;
+
+  *ids = NULL;
+  *n   = 0;
+  if ((status = fileViewOpen (ctx, file, &v)) != FS_OK)
+    return (status);
+  status = viewSample (ctx, &v, k, strata, ids, n);
+  viewClose (&v);
+  return (status);
+}
+
+int
+fsFileIsBinary (const char * file)
+{
+  char   buf[sizeof(BITS_MAGIC)];
+  FILE * fp;
+  size_t n;
+
+  if ((fp = fopen (file, "r")) == NULL)
+    return (FALSE);
+  n = fread (buf, 1, strlen(BITS_MAGIC), fp);
+  fclose(fp);
+
+  return (n == strlen(BITS_MAGIC) && memcmp (buf, BITS_MAGIC, n) == 0);
+}
+
+FsStatus
+fsFileRank (FsContext * ctx, const char * file, uint32_t id, uint64_t * rank)
+{
+  View     v;
+  FsStatus status;
+
+  if ((status = fileViewOpen (ctx, file, &v)) != FS_OK)
+    return (status);
+  *rank = viewRank (&v, id);
+  viewClose (&v);
+  return (FS_OK);
+}
+
+FsStatus
+fsFileSelect (FsContext * ctx, const char * file, uint64_t k, uint32_t * id)
+{
+  View     v;
+  FsStatus status;
+
+  if ((status = fileViewOpen (ctx, file, &v)) != FS_OK)
+    return (status);
+  if (k >= v.count)
+    status = fsFail (ctx, FS_ERANGE, "offset %lu is past the last of %lu IDs", k, v.count);
+  else
+    *id = viewSelect (&v, k);
+  viewClose (&v);
+  return (status);
+}
+
+FsStatus
+fsFileWritePage (FsContext * ctx, const char * file, FILE * fp, FsFormat format,
+                 uint32_t first, uint32_t last, uint64_t offset, uint64_t limit)
+{
+  View     v;
+  FsStatus status;
+
+  if ((status = fileViewOpen (ctx, file, &v)) != FS_OK)
+    return (status);
+  status = viewWritePage (ctx, &v, fp, format, first, last, offset, limit);
+  viewClose (&v);
+  return (status);
+}
+
+/* -------------------------------------------------------------------- */
+
+void
+fsContextMemLimit (FsContext * ctx, uint64_t bytes)
+{
+  ctx->memLimit = bytes;
+}
+
+FsStatus
+fsEval (FsContext * ctx, const char * expr, FsSet ** result)
+{
+  Stack  * postfix;
+  FsStatus status;
+
+  *result = NULL;
+
+  if ((postfix = stackNew(ctx)) == NULL)
+    return (ctx->status);
+
+  if ((status = convertToPostfix (ctx, expr, postfix)) == FS_OK)
+    status = execute (ctx, postfix, result);
+
+  stackFree (ctx, postfix, TRUE);
+
+  return (status);
+}
+
+/*
+ * Evaluate expr and write the result to fp, within the context's memory
+ * limit: when the set vectors the expression holds at once (exprPeak())
+ * don't fit, the ID range is evaluated in passes (see evalPasses()),
+ * each as large as fits, which only the ID and range formats can take.
+ * The limit also covers the buffers a run holds whatever its vectors:
+ * the writer's ring, a load's scatter batch and, with passes, a buffer
+ * per partition open at once.
+ */
+FsStatus
+fsEvalWrite (FsContext * ctx, const char * expr, FILE * fp, FsFormat format)
+{
+  Stack  * postfix;
+  Token  * root;
+  Set    * s;
+  boolean  complement;
+  uint64   vectors, span = 0, fixed, batch, cap, passes = 0;
+  FsStatus status;
+
+  if ((postfix = stackNew(ctx)) == NULL)
+    return (ctx->status);
+  if ((status = convertToPostfix (ctx, expr, postfix)) == FS_OK &&
+      (status = exprTree (ctx, postfix, &root)) == FS_OK)
+  {
+    vectors = exprPeak (root, &complement);
+    tokenTreeFree (ctx, root);
+  }
+  stackFree (ctx, postfix, TRUE);
+  if (status != FS_OK)
+    return (status);
+
+  fixed = (uint64) WRITE_SLOTS * WRITE_BUFFER +
+          sizeof(uint32) * (2 * (uint64) SCATTER_BATCH + (ctx->max >> SCATTER_SHIFT) + 1);
+
+  if (ctx->memLimit == 0 || (ctx->memLimit >= fixed && vectors * vectorSize(ctx) <= ctx->memLimit - fixed))
+  {
+    if ((status = fsEval (ctx, expr, &s)) == FS_OK)
+    {
+      status = fsSetWrite (ctx, s, fp, format);
+      setFree (ctx, s);
+    }
+    return (status);
+  }
+
+  if (format != FS_FORMAT_IDS && format != FS_FORMAT_RANGES)
+    return (fsFail (ctx, FS_EINVAL, "%lu vectors of %lu bytes are over the memory limit, "
+                    "and only IDs and ranges can be written in passes", vectors, vectorSize(ctx)));
+
+  /*
+   * IDs per pass: as many bytes per vector as fit beside the fixed
+   * buffers and a partition buffer for each of batch passes, counting
+   * the result of the pass before, still being written (see
+   * evalPasses()), less ID 0, in whole huge pages if a pass's vectors
+   * would still be mapped. Fewer partition buffers leave bigger passes,
+   * so take the smallest batch that covers the passes it leaves room
+   * for (or is as many as can be open at once).
+   */
+  cap = partitionBatch (ctx->max);
+  for (batch = 1; passes == 0 && batch <= cap && ctx->memLimit >= fixed + batch * PARTITION_BUFFER; batch++)
+  {
+    span = (ctx->memLimit - fixed - batch * PARTITION_BUFFER) / (vectors + 1);
+    if (span >= HUGE_PAGE_SIZE && ctx->hugePages && ! ctx->customAlloc)
+      span = span / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    if (span < 2)
+      break;
+    if ((ctx->max + span - 2) / (span - 1) <= batch || batch == cap)
+      passes = (ctx->max + span - 2) / (span - 1);
+  }
+  if (passes == 0)
+    return (fsFail (ctx, FS_ENOMEM, "the memory limit (%lu bytes) is less than one pass needs: "
+                    "%lu bytes of buffers and %lu vectors of 2 bytes",
+                    ctx->memLimit, fixed + PARTITION_BUFFER, vectors + 1));
+  span--;
+
+  if (ctx->verbose)
+    fprintf (stderr, "memory: %lu vectors of %lu bytes and %lu bytes of buffers over the %lu byte limit\n",
+             vectors, vectorSize(ctx), fixed + partitionBatch (passes) * PARTITION_BUFFER, ctx->memLimit);
+
+  return (evalPasses (ctx, expr, fp, format, span, passes));
+}
+
+/*
+ * Bring the result saved in stateFile up to date by parsing only what
+ * was appended to the inputs since, falling back to evaluating the
+ * whole expression when nodeChange() can't, and save the new state.
+ * added and removed, if not NULL, get the IDs that joined and left the
+ * result since the saved run (all of it, if there was none).
+ */
+FsStatus
+fsEvalIncremental (FsContext * ctx, const char * expr, const char * stateFile,
+                   FsSet ** result, FsSet ** added, FsSet ** removed)
+{
+  State  * st = NULL;
+  Token  * root;
+  Change   c;
+  Stack  * postfix = NULL;
+  char   * input;
+  Set    * res = NULL, * add = NULL, * rem = NULL;
+  Set    * sets[1];
+  FsStatus status;
+
+  *result = NULL;
+  if (added)   *added   = NULL;
+  if (removed) *removed = NULL;
+
+  if ((input = ctxStrdup (ctx, expr)) == NULL)
+    return (ctx->status);
+  exprNormalize (input);
+
+  if ((status = stateLoad (ctx, stateFile, &st)) != FS_OK)
+    goto done;
+  if ((ctx->inputs = stackNew(ctx)) == NULL || (postfix = stackNew(ctx)) == NULL)
+  {
+    status = ctx->status;
+    goto done;
+  }
+
+  if (st != NULL && st->result != NULL && strcmp (st->expr, input) == 0)
+  {
+    if ((status = convertToPostfix (ctx, input, postfix)) != FS_OK ||
+        (status = exprTree (ctx, postfix, &root)) != FS_OK)
+      goto done;
+
+    status = nodeChange (ctx, root, st, &c);
+    tokenTreeFree (ctx, root);
+    if (status != FS_OK)
+      goto done;
+
+    if (c.type != RECOMPUTE)
+    {
+      res = st->result;
+      st->result = NULL;
+
+      /* the IDs of an ADDED delta that are new, or of a REMOVED one that were there */
+      sets[0] = res;
+      if (added != NULL && (add = setMinus (ctx, (c.type == ADDED) ? c.delta : NULL, res)) == NULL)
+        status = ctx->status;
+      if (removed != NULL && (rem = setMinus (ctx, (c.type == REMOVED) ? c.delta : NULL, NULL)) == NULL)
+        status = ctx->status;
+      if (rem != NULL)
+        setFold (ctx, rem, 'X', sets, 1);
+
+      if (c.type != UNCHANGED)
+      {
+        sets[0] = c.delta;
+        setFold (ctx, res, (c.type == ADDED) ? 'U' : 'D', sets, 1);
+      }
+      changeFree (ctx, &c);
+      if (status != FS_OK)
+        goto done;
+      if (ctx->verbose) fprintf (stderr, "incremental: updated from appended input\n");
+    }
+  }
+
+  if (res == NULL)
+  {
+    if (ctx->verbose) fprintf (stderr, "incremental: full recompute\n");
+
+    inputsFree (ctx, ctx->inputs);
+    stackFree (ctx, postfix, TRUE);
+    postfix = NULL;
+    if ((ctx->inputs = stackNew(ctx)) == NULL || (postfix = stackNew(ctx)) == NULL)
+    {
+      status = ctx->status;
+      goto done;
+    }
+
+    if ((status = convertToPostfix (ctx, input, postfix)) != FS_OK ||
+        (status = execute (ctx, postfix, &res)) != FS_OK)
+      goto done;
+
+    if (st != NULL && st->result == NULL)
+    {
+      stateFree (ctx, st);
+      st = NULL;
+    }
+    if (added != NULL && (add = setMinus (ctx, res, (st != NULL) ? st->result : NULL)) == NULL)
+    {
+      status = ctx->status;
+      goto done;
+    }
+    if (removed != NULL && (rem = setMinus (ctx, (st != NULL) ? st->result : NULL, res)) == NULL)
+    {
+      status = ctx->status;
+      goto done;
+    }
+  }
+
+  /* a result brought up to date from the state, and the deltas, are named by the expression */
+  if ((res->x.history == NULL && (res->x.history = ctxStrdup (ctx, input)) == NULL) ||
+      (add != NULL && (add->x.history = ctxStrdup (ctx, input)) == NULL) ||
+      (rem != NULL && (rem->x.history = ctxStrdup (ctx, input)) == NULL))
+  {
+    status = ctx->status;
+    goto done;
+  }
+
+  status = stateSave (ctx, stateFile, input, res);
+
+done:
+  if (status == FS_OK)
+  {
+    *result = res;
+    if (added)   *added   = add;
+    if (removed) *removed = rem;
+  }
+  else
+  {
+    fsSetFree (ctx, res);
+    fsSetFree (ctx, add);
+    fsSetFree (ctx, rem);
+  }
+
+  inputsFree (ctx, ctx->inputs);
+  ctx->inputs = NULL;
+  stackFree (ctx, postfix, TRUE);
+  stateFree (ctx, st);
+  ctxFree (ctx, input);
+
+  return (status);
+}
@@ -0,0 +1,27 @@
+#
+# Format: expectedResultFile   [options] expression
+#
+# The first run saves its state; the later ones are brought up to date
+# from it (nothing was appended, so -delta reports no changes). A line
+# starting with ! is a shell command run before the next test.
+#
+
+even.txt		-i /tmp/fs-test.state even.txt U ( all.txt X 1to10even.txt )
+even.txt		-i /tmp/fs-test.state even.txt U ( all.txt X 1to10even.txt )
+none.txt		-i /tmp/fs-test.state -delta even.txt U ( all.txt X 1to10even.txt )
+odd.txt			-i /tmp/fs-test.state I ( even.txt U none.txt )
+
+# A last line without its newline is left for the run that sees it
+# finished, so the partial "1" never joins the result
+! rm -f /tmp/fs-test.state && printf '2\n3\n' > /tmp/fs-test-grow.txt
+2and3.txt		-i /tmp/fs-test.state /tmp/fs-test-grow.txt
+! printf '1' >> /tmp/fs-test-grow.txt
+2and3.txt		-i /tmp/fs-test.state /tmp/fs-test-grow.txt
+! printf '7\n' >> /tmp/fs-test-grow.txt
+2and3and17.txt		-i /tmp/fs-test.state /tmp/fs-test-grow.txt
+2and3and17.txt		/tmp/fs-test-grow.txt
+
+# -v names a result brought up to date from the state when shuffling it
+! rm -f /tmp/fs-test.state
+twelve.txt		-i /tmp/fs-test.state -v -s twelve.txt D none.txt
+twelve.txt		-i /tmp/fs-test.state -v -s twelve.txt D none.txt
@@ -0,0 +1,32 @@
+#
+# Format: expectedResultFile   [options] expression
+#
+# Chains of the same operator are evaluated as one n-ary operation.
+#
+
+# Long chains, including sub-expression operands folded together
+all.txt			1to10.txt U even.txt U odd.txt U 11to20.txt U none.txt
+fourths.txt		all.txt X ( even.txt U odd.txt ) X fourths.txt X even.txt
+1to10even.txt		1to10.txt X ( I odd.txt ) X ( all.txt D 11to20.txt ) X even.txt
+twelve.txt		all.txt D odd.txt D ( I fourths.txt ) D 1to10.txt D 16and20.txt
+fourthsMinus12.txt	( all.txt D twelve.txt ) X ( fourths.txt U fourths.txt ) X even.txt
+
+# Expression read from a file
+even.txt		-f evenSplit.exp
+
+# Operator applied to a list of files
+all.txt			-U evenOdd.lst
+none.txt		-X evenOdd.lst
+1to10even.txt		-X evenTo10.lst
+all.txt			-U evenTo10.lst
+
+# More intersection operands than a generation mark can count
+fourths.txt		-X fourths300.lst
+
+# Complemented operands and accumulators, folded without inverting them
+all.txt			I even.txt U even.txt U twelve.txt
+1to10even.txt		I odd.txt D 11to20.txt D none.txt
+fourths.txt		I odd.txt X fourths.txt X all.txt
+none.txt		I even.txt X I odd.txt
+odd.txt			I ( even.txt U none.txt ) U I all.txt
+twelve.txt		I ( I twelve.txt )
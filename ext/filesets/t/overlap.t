@@ -0,0 +1,10 @@
+#
+# Format: expectedResultFile   [options] files
+#
+# -overlap writes the size of the intersection of every pair of files.
+#
+
+overlap.csv		-overlap even.txt odd.txt fourths.txt 1to10.rng
+overlap.csv		-t 2 -overlap even.txt odd.txt fourths.txt 1to10.rng
+jaccard.csv		-overlap -jaccard even.txt odd.txt fourths.txt 1to10.rng
+overlap.json		-overlap -json -jaccard even.txt odd.txt fourths.txt 1to10.rng
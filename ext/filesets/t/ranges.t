@@ -0,0 +1,33 @@
+#
+# Format: expectedResultFile   [options] expression
+#
+# Input lines first-last stand for a range of IDs; -r writes runs
+# of consecutive IDs that way.
+#
+
+# Range input
+1to10.txt		1to10.rng
+1to10.txt		mixed.rng
+all.txt			1to10.rng U 11to20.rng
+1to10even.txt		even.txt X 1to10.rng
+even.txt		1to10.rng X even.txt U ( 11to20.rng D odd.txt )
+12to20even.txt		I 1to10.rng X all.txt X even.txt X 11to20.rng
+11to20.txt		T 3 ( 11to20.rng all.txt 11to20.txt )
+
+# Range output
+1to10.rng		-r 1to10.txt
+1to10.rng		-r mixed.rng
+fourthsAnd11to20.rng	-r fourths.txt U 11to20.txt
+fourthsAnd11to20.rng	-r fourthsAnd11to20.rng
+even.txt		-r even.txt
+none.txt		-r none.txt
+
+# Written by fsEvalWrite(), in one pass and then in passes (a limit
+# has room for the writer's and the parser's buffers beside the
+# vectors, so passes need a larger max ID)
+fourthsAnd11to20.rng	-r -mem 64M fourths.txt U 11to20.txt
+12to20even.txt		-mem 64M I 1to10.rng X all.txt X even.txt X 11to20.rng
+fourthsAnd11to20.rng	-r -max 20000000 -mem 24M fourths.txt U 11to20.txt
+12to20even.txt		-max 20000000 -mem 24M I 1to10.rng X all.txt X even.txt X 11to20.rng
+fourthsAnd11to20.rng	-r -max 20000000 -mem 16M fourths.txt U 11to20.txt
+12to20even.txt		-nohuge -max 20000000 -mem 20M I 1to10.rng X all.txt X even.txt X 11to20.rng
@@ -0,0 +1,31 @@
+#
+# Format: expectedResultFile   [options] expression
+#
+# -offset, -limit and -idrange write one page of the result; -rank
+# writes how many IDs are less than the given one. even.bin is even.txt
+# written with -b, so the queries on it alone come from its index.
+#
+
+# Pages of an evaluated result
+1to10even.txt		-limit 5 even.txt
+12to20even.txt		-offset 5 even.txt
+12to20even.txt		-idrange 11:20 even.txt
+twelve.txt		-idrange 11:20 -offset 0 -limit 1 even.txt
+16and20.txt		-idrange 13:20 fourths.txt U twelve.txt
+none.txt		-offset 20 all.txt
+twenty.txt		-offset 9 even.txt
+none.txt		-limit 0 all.txt
+1to10.rng		-r -idrange 1:10 all.txt
+five.txt		-rank 12 even.txt
+five.txt		-rank 6 all.txt
+
+# Binary set files
+even.bin		-b even.txt
+even.txt		even.bin
+odd.txt			I even.bin
+fourths.txt		even.bin X fourths.txt
+1to10even.txt		-limit 5 even.bin
+12to20even.txt		-idrange 11:20 even.bin
+twelve.txt		-idrange 11:20 -limit 1 even.bin
+twenty.txt		-offset 9 even.bin
+five.txt		-rank 12 even.bin
@@ -0,0 +1,15 @@
+#
+# Format: expectedResultFile   [options] expression
+#
+# -n k writes k IDs of the result chosen at random; -seed makes the
+# choice repeatable.
+#
+
+all.txt			-n 20 all.txt
+even.txt		-n 100 even.txt
+none.txt		-n 0 all.txt
+none.txt		-n 5 none.txt
+sample5.txt		-n 5 -seed 7 all.txt
+sample5.txt		-n 5 -seed 7 -t 2 1to10.rng U 11to20.txt
+sample3even.txt		-n 3 -seed 7 even.txt
+sample3even.txt		-n 3 -seed 7 even.bin
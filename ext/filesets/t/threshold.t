@@ -0,0 +1,14 @@
+#
+# Format: expectedResultFile   expression
+#
+# T k ( a1 ... an ) keeps the IDs found in at least k of its operands.
+#
+
+all.txt			T 1 ( even.txt odd.txt )
+none.txt		T 2 ( even.txt odd.txt )
+1to10.txt		T 2 ( even.txt odd.txt 1to10.txt )
+even.txt		T 3 ( all.txt ( even.txt U odd.txt ) even.txt fourths.txt )
+fourths.txt		T 3 ( even.txt fourths.txt fourths.txt )
+none.txt		T 4 ( even.txt fourths.txt fourths.txt )
+16and20.txt		T 2 ( fourths.txt ( fourths.txt D 1to10.txt ) ( I fourths.txt ) twelve.txt ) D twelve.txt
+fourthsMinus12.txt	T 1 ( T 2 ( even.txt fourths.txt ) twelve.txt ) D twelve.txt
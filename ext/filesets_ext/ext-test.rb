@@ -0,0 +1,82 @@
+#!/usr/bin/env ruby
+#
+# Checks the Ruby extension against the fixtures in ../filesets/t.
+#
+# Usage: ext-test.rb (after ruby extconf.rb && make in this directory)
+#
+
+require 'fileutils'
+require 'tmpdir'
+
+Dir.chdir(File.dirname(File.expand_path(__FILE__)))
+
+# Lay the built extension out the way the gem installs it
+Lib = Dir.mktmpdir("fs-ext")
+at_exit { FileUtils.rm_rf(Lib) }
+Dir.mkdir("#{Lib}/filesets")
+ext = "filesets_ext.#{RbConfig::CONFIG["DLEXT"]}"
+File.symlink(File.expand_path(ext), "#{Lib}/filesets/#{ext}")
+$LOAD_PATH.unshift(Lib, File.expand_path("../../lib"))
+require 'filesets'
+
+T = "../filesets/t"
+Failures = []
+
+def check(name, got, expected)
+  Failures << "#{name}: got #{got.inspect}, expected #{expected.inspect}" if got != expected
+end
+
+def ids(file)
+  File.readlines("#{T}/#{file}").map(&:to_i).sort
+end
+
+Filesets.max = 1000
+Filesets.threads = 2
+
+even   = Filesets::Set.load("#{T}/even.txt")
+odd    = Filesets::Set.load("#{T}/odd.txt")
+fourth = Filesets::Set.load("#{T}/fourths.txt")
+
+check("load",        even.to_a,                 ids("even.txt"))
+check("count",       even.count,                ids("even.txt").size)
+check("union",       (even | odd).to_a,         (ids("even.txt") | ids("odd.txt")).sort)
+check("intersect",   (even & fourth).to_a,      ids("even.txt") & ids("fourths.txt"))
+check("diff",        (even - fourth).to_a,      ids("even.txt") - ids("fourths.txt"))
+check("invert",      (~even).to_a,              (1..1000).to_a - ids("even.txt"))
+check("unchanged",   even.to_a,                 ids("even.txt"))
+check("n-ary",       Filesets::Set.new.union!(even, odd, fourth).count, (ids("even.txt") | ids("odd.txt")).size)
+check("each",        fourth.each.to_a,          ids("fourths.txt"))
+check("from_ids",    Filesets::Set.from_ids([7, 3, 7]).to_a, [3, 7])
+check("ranges",      Filesets::Set.load("#{T}/1to10.rng").to_a, (1..10).to_a)
+check("shuffle",     even.shuffle(42).unpack("L*").sort, ids("even.txt"))
+check("shuffle seed", even.shuffle(42), even.shuffle(42))
+check("self operand", even.dup.union!(even, even).to_a, ids("even.txt"))
+
+# Calls on one set from several threads take turns on its mutex
+shared  = Filesets::Set.new
+threads = [even, odd, fourth].map { |s| Thread.new { 20.times { shared.union!(s, odd); shared.count } } }
+threads.each(&:join)
+check("threads",     shared.to_a,               (ids("even.txt") | ids("odd.txt")).sort)
+seen = []
+shared.each { |id| seen << id; shared.intersect!(even) if seen.size == 1 }
+check("change in each", seen.first,             1)
+check("after each",  shared.to_a,               ids("even.txt"))
+
+[
+  ["bad id",      ArgumentError,   -> { Filesets::Set.from_ids([1001]) }],
+  ["missing",     Filesets::Error, -> { Filesets::Set.load("#{T}/no-such-file") }],
+  ["change max",  Filesets::Error, -> { Filesets.max = 2000 }],
+].each do |name, error, block|
+  begin
+    block.call
+    Failures << "#{name}: no #{error} raised"
+  rescue error
+  end
+end
+
+if Failures.empty?
+  puts "Passed all extension tests."
+else
+  puts Failures
+  exit(1)
+end
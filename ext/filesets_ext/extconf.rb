@@ -0,0 +1,12 @@
+require 'mkmf'
+
+# The set operations come from libfilesets, compiled in from its source.
+$VPATH   << "$(srcdir)/../filesets"
+$INCFLAGS << " -I$(srcdir)/../filesets"
+$srcs     = ["filesets_ext.c", "libfilesets.c"]
+$CFLAGS  << " -O3 -pthread"
+
+have_header("ruby/thread.h") or abort "filesets needs rb_thread_call_without_gvl()"
+have_library("pthread")
+
+create_makefile("filesets/filesets_ext")
@@ -0,0 +1,634 @@
+/*
+ * Ruby binding: Filesets::Set holds a set vector in C, so a Ruby
+ * process can load and combine sets without running the filesets
+ * program and parsing its output. IDs cross into Ruby only as packed
+ * strings of native 32-bit integers (String#unpack("L*")) or one at a
+ * time through each, and the heavy work runs with the GVL released so
+ * other Ruby threads keep running.
+ *
+ * All sets share one max ID (Filesets.max), which can't be changed
+ * while any set is alive or being made. Each call gets its own
+ * libfilesets context, so calls on different sets can run at once;
+ * each set has a mutex, held by a call for every set it uses, so calls
+ * on the same set from different threads take turns. Packed strings are locked with
+ * rb_str_locktmp() while C uses them.
+ */
+#include <ruby.h>
+#include <ruby/thread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "filesets.h"
+
+#define EACH_CHUNK  65536   /* IDs collected without the GVL per batch of yields */
+
+static VALUE       mFilesets, cSet, eError;
+static long        LiveSets = 0;    /* sets alive or being made; Filesets.max can't change */
+static uint32_t    Threads  = 1;
+static FsContext * Ctx      = NULL;   /* holds Filesets.max; frees sets */
+
+/* One call into libfilesets, with its arguments and results */
+typedef struct _Call {
+  FsStatus   (* fn) (struct _Call * c);
+  FsContext  * ctx;
+  FsSet      * s;
+  FsSet     ** sets;
+  uint32_t     n;
+  char         op;
+  const char * path;
+  char       * str;
+  uint64_t     len;
+  uint32_t     cursor;
+  uint32_t   * ids;
+  int          seeded;
+  uint64_t     seed;
+  FsStatus     status;
+  VALUE        errorClass;
+} Call;
+
+static void *
+callWithoutGvl (void * arg)
+{
+  Call * c = arg;
+
+  c->status = c->fn (c);
+  return (NULL);
+}
+
+/*
+ * Run c->fn in a context of its own without the GVL, raising
+ * c->errorClass (Filesets::Error by default) if it fails. The call
+ * counts as a live set while it runs, so Filesets.max can't change
+ * under it, and a set it makes stays counted until setDataFree().
+ */
+static void
+run (Call * c, const char * what)
+{
+  FsStatus status;
+  FsSet  * given = c->s;
+  VALUE    msg;
+
+  if ((status = fsContextNew (&c->ctx, fsContextMax (Ctx), NULL)) != FS_OK)
+    rb_raise (eError, "%s: %s", what, fsStatusName (status));
+  fsContextThreads (c->ctx, Threads);
+  if (c->seeded)
+    fsContextSeed (c->ctx, c->seed);
+
+  LiveSets++;
+  rb_thread_call_without_gvl (callWithoutGvl, c, NULL, NULL);
+  if (c->status != FS_OK || c->s == given)
+    LiveSets--;
+
+  if (c->status != FS_OK)
+  {
+    msg = rb_sprintf ("%s: %s", what, fsErrorMessage (c->ctx));
+    fsContextFree (c->ctx);
+    rb_exc_raise (rb_exc_new_str (NIL_P (c->errorClass) ? eError : c->errorClass, msg));
+  }
+  fsContextFree (c->ctx);
+}
+
+static void
+callInit (Call * c, FsStatus (* fn) (Call * c))
+{
+  memset (c, 0, sizeof(*c));
+  c->fn         = fn;
+  c->errorClass = Qnil;
+}
+
+/* -------------------------------------------------------------------- */
+
+/* What a Filesets::Set wraps: the set, and the mutex calls on it hold */
+typedef struct _SetData {
+  FsSet * s;
+  VALUE   lock;
+} SetData;
+
+static void
+setDataMark (void * p)
+{
+  rb_gc_mark (((SetData *) p)->lock);
+}
+
+static void
+setDataFree (void * p)
+{
+  SetData * d = p;
+
+  if (d->s)
+  {
+    fsSetFree (Ctx, d->s);
+    LiveSets--;
+  }
+  xfree (d);
+}
+
+static size_t
+setDataSize (const void * p)
+{
+  return (sizeof(SetData) + (((const SetData *) p)->s ? (size_t) fsContextMax (Ctx) + 1 : 0));
+}
+
+static const rb_data_type_t SetType = {
+  "Filesets::Set",
+  { setDataMark, setDataFree, setDataSize, },
+  NULL, NULL,
+  RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+static VALUE
+setAlloc (VALUE klass)
+{
+  SetData * d;
+  VALUE     obj;
+
+  obj     = TypedData_Make_Struct (klass, SetData, &SetType, d);
+  d->lock = rb_mutex_new ();
+  return (obj);
+}
+
+static SetData *
+getData (VALUE obj)
+{
+  SetData * d;
+
+  TypedData_Get_Struct (obj, SetData, &SetType, d);
+  return (d);
+}
+
+static FsSet *
+getSet (VALUE obj)
+{
+  SetData * d = getData (obj);
+
+  if (d->s == NULL)
+    rb_raise (eError, "uninitialized set");
+  return (d->s);
+}
+
+static void
+setAttach (VALUE obj, FsSet * s)
+{
+  getData (obj)->s = s;
+}
+
+/* -------------------------------------------------------------------- */
+
+/* body(arg) with the mutexes of some sets held */
+typedef struct _Locked {
+  VALUE   * locks;
+  int       n;
+  int       held;
+  VALUE  (* body) (VALUE arg);
+  VALUE     arg;
+} Locked;
+
+static int
+lockCompare (const void * a, const void * b)
+{
+  VALUE x = *(const VALUE *) a, y = *(const VALUE *) b;
+
+  return (x < y ? -1 : x > y);
+}
+
+static VALUE
+lockedBody (VALUE arg)
+{
+  Locked * l = (Locked *) arg;
+
+  for (l->held = 0; l->held < l->n; l->held++)
+    rb_mutex_lock (l->locks[l->held]);
+  return (l->body (l->arg));
+}
+
+static VALUE
+lockedRelease (VALUE arg)
+{
+  Locked * l = (Locked *) arg;
+
+  while (l->held > 0)
+    rb_mutex_unlock (l->locks[--l->held]);
+  return (Qnil);
+}
+
+/*
+ * Call body(arg) holding the mutex of each of the n sets in objs, once
+ * each (a set may be given more than once) and in address order, so
+ * two calls on overlapping sets can't deadlock. The mutexes are
+ * released if body raises.
+ */
+static VALUE
+withSets (VALUE * objs, int n, VALUE (* body) (VALUE arg), VALUE arg)
+{
+  Locked l;
+  VALUE  tmp, result;
+  int    i, j;
+
+  l.locks = ALLOCV_N (VALUE, tmp, n);
+  for (i = 0; i < n; i++)
+    l.locks[i] = getData (objs[i])->lock;
+  qsort (l.locks, n, sizeof(VALUE), lockCompare);
+  for (i = 0, j = 0; i < n; i++)
+    if (j == 0 || l.locks[i] != l.locks[j - 1])
+      l.locks[j++] = l.locks[i];
+  l.n    = j;
+  l.held = 0;
+  l.body = body;
+  l.arg  = arg;
+
+  result = rb_ensure (lockedBody, (VALUE) &l, lockedRelease, (VALUE) &l);
+  ALLOCV_END (tmp);
+
+  return (result);
+}
+
+/* run(), as the body of withSets() */
+typedef struct _Run {
+  Call       * c;
+  const char * what;
+} Run;
+
+static VALUE
+runBody (VALUE arg)
+{
+  Run * r = (Run *) arg;
+
+  run (r->c, r->what);
+  return (Qnil);
+}
+
+/* run() with the mutexes of the n sets in objs held */
+static void
+runOn (Call * c, const char * what, VALUE * objs, int n)
+{
+  Run r = { c, what };
+
+  withSets (objs, n, runBody, (VALUE) &r);
+}
+
+static void
+requireMax (void)
+{
+  if (Ctx == NULL)
+    rb_raise (eError, "set Filesets.max before creating sets");
+}
+
+/* -------------------------------------------------------------------- */
+
+static FsStatus doNew (Call * c)      { return (fsSetNew (c->ctx, &c->s)); }
+static FsStatus doLoad (Call * c)     { return (fsSetLoad (c->ctx, c->path, &c->s)); }
+static FsStatus doCopy (Call * c)     { return (fsSetCopy (c->ctx, c->s, &c->s)); }
+static FsStatus doFold (Call * c)     { return (fsSetFold (c->ctx, c->s, c->op, c->sets, c->n)); }
+static FsStatus doInvert (Call * c)   { return (fsSetInvert (c->ctx, c->s)); }
+static FsStatus doShuffle (Call * c)  { return (fsSetShuffle (c->ctx, c->s, &c->ids, &c->len)); }
+
+static FsStatus
+doUnpack (Call * c)
+{
+  return (fsSetFromIds (c->ctx, (uint32_t *) c->str, c->len, &c->s));
+}
+
+static FsStatus
+doCount (Call * c)
+{
+  c->len = fsSetCount (c->ctx, c->s);
+  return (FS_OK);
+}
+
+/* Fill c->ids with the next c->len members from c->cursor on */
+static FsStatus
+doIds (Call * c)
+{
+  c->n = fsSetIds (c->ctx, c->s, &c->cursor, c->ids, c->len);
+  return (FS_OK);
+}
+
+/* -------------------------------------------------------------------- */
+
+/*
+ * Filesets::Set.new -> an empty set
+ */
+static VALUE
+setInitialize (VALUE self)
+{
+  Call c;
+
+  requireMax();
+  callInit (&c, doNew);
+  run (&c, "Filesets::Set.new");
+  setAttach (self, c.s);
+
+  return (self);
+}
+
+static VALUE
+setInitializeCopy (VALUE self, VALUE orig)
+{
+  Call c;
+
+  if (self == orig)
+    return (self);
+
+  callInit (&c, doCopy);
+  c.s = getSet (orig);
+  runOn (&c, "Filesets::Set#dup", &orig, 1);
+  setAttach (self, c.s);
+
+  return (self);
+}
+
+/*
+ * Filesets::Set.load(path) -> the set of IDs in a file, one per line or
+ * as first-last ranges
+ */
+static VALUE
+setLoad (VALUE klass, VALUE path)
+{
+  Call  c;
+  VALUE obj;
+
+  requireMax();
+  FilePathValue (path);
+
+  callInit (&c, doLoad);
+  c.path = StringValueCStr (path);
+  obj    = setAlloc (klass);
+  run (&c, "Filesets::Set.load");
+  setAttach (obj, c.s);
+  RB_GC_GUARD (path);
+
+  return (obj);
+}
+
+/*
+ * Filesets::Set.from_packed(str) -> the set of IDs packed in str as
+ * native 32-bit integers (Array#pack("L*"))
+ */
+static VALUE
+setFromPacked (VALUE klass, VALUE str)
+{
+  Call  c;
+  Run   r;
+  VALUE obj;
+
+  requireMax();
+  StringValue (str);
+  if (RSTRING_LEN (str) % sizeof(uint32_t) != 0)
+    rb_raise (rb_eArgError, "packed IDs must be a multiple of %lu bytes", sizeof(uint32_t));
+
+  callInit (&c, doUnpack);
+  obj = setAlloc (klass);
+
+  /* other threads can't change str while C reads it without the GVL */
+  rb_str_locktmp (str);
+  c.str        = RSTRING_PTR (str);
+  c.len        = RSTRING_LEN (str) / sizeof(uint32_t);
+  c.errorClass = rb_eArgError;
+  r.c          = &c;
+  r.what       = "Filesets::Set.from_packed";
+  rb_ensure (runBody, (VALUE) &r, rb_str_unlocktmp, str);
+  setAttach (obj, c.s);
+  RB_GC_GUARD (str);
+
+  return (obj);
+}
+
+static VALUE
+setFoldArgs (VALUE self, int argc, VALUE * argv, char op, const char * what)
+{
+  Call    c;
+  VALUE   tmp, otmp;
+  VALUE * objs;
+  int     i;
+
+  callInit (&c, doFold);
+  c.s    = getSet (self);
+  c.op   = op;
+  c.n    = argc;
+  c.sets = ALLOCV_N (FsSet *, tmp, argc);
+  objs   = ALLOCV_N (VALUE, otmp, argc + 1);
+  objs[0] = self;
+  for (i = 0; i < argc; i++)
+  {
+    c.sets[i]   = getSet (argv[i]);
+    objs[i + 1] = argv[i];
+  }
+
+  if (argc > 0)
+    runOn (&c, what, objs, argc + 1);
+  ALLOCV_END (otmp);
+  ALLOCV_END (tmp);
+
+  return (self);
+}
+
+/* set.union!(other, ...) -> set, with every ID in any other added */
+static VALUE
+setUnionBang (int argc, VALUE * argv, VALUE self)
+{
+  return (setFoldArgs (self, argc, argv, 'U', "Filesets::Set#union!"));
+}
+
+/* set.intersect!(other, ...) -> set, keeping only IDs in every other */
+static VALUE
+setIntersectBang (int argc, VALUE * argv, VALUE self)
+{
+  return (setFoldArgs (self, argc, argv, 'X', "Filesets::Set#intersect!"));
+}
+
+/* set.diff!(other, ...) -> set, with every ID in any other removed */
+static VALUE
+setDiffBang (int argc, VALUE * argv, VALUE self)
+{
+  return (setFoldArgs (self, argc, argv, 'D', "Filesets::Set#diff!"));
+}
+
+/* set.invert! -> set, complemented over 1..Filesets.max */
+static VALUE
+setInvertBang (VALUE self)
+{
+  Call c;
+
+  callInit (&c, doInvert);
+  c.s = getSet (self);
+  runOn (&c, "Filesets::Set#invert!", &self, 1);
+
+  return (self);
+}
+
+/* set.count -> the number of IDs in the set */
+static VALUE
+setCountIds (VALUE self)
+{
+  Call c;
+
+  callInit (&c, doCount);
+  c.s = getSet (self);
+  runOn (&c, "Filesets::Set#count", &self, 1);
+
+  return (ULL2NUM (c.len));
+}
+
+/* Count, then fill a string that size, with no change to the set between */
+static VALUE
+toPackedBody (VALUE self)
+{
+  Call  c;
+  Run   r = { &c, "Filesets::Set#to_packed" };
+  VALUE str;
+
+  callInit (&c, doCount);
+  c.s = getSet (self);
+  run (&c, r.what);
+
+  str      = rb_str_new (NULL, c.len * sizeof(uint32_t));
+  c.fn     = doIds;
+  c.cursor = 1;
+  rb_str_locktmp (str);
+  c.ids    = (uint32_t *) RSTRING_PTR (str);
+  rb_ensure (runBody, (VALUE) &r, rb_str_unlocktmp, str);
+
+  return (str);
+}
+
+/* set.to_packed -> the IDs in ascending order, packed as "L*" */
+static VALUE
+setToPacked (VALUE self)
+{
+  return (withSets (&self, 1, toPackedBody, self));
+}
+
+/*
+ * set.shuffle(seed = nil) -> the IDs in random order, packed as "L*".
+ * Pass a seed for a repeatable order.
+ */
+static VALUE
+setShuffleIds (int argc, VALUE * argv, VALUE self)
+{
+  Call  c;
+  VALUE seed, str;
+
+  rb_scan_args (argc, argv, "01", &seed);
+
+  callInit (&c, doShuffle);
+  c.s = getSet (self);
+  if ( ! NIL_P (seed))
+  {
+    c.seeded = 1;
+    c.seed   = NUM2ULL (seed);
+  }
+  runOn (&c, "Filesets::Set#shuffle", &self, 1);
+
+  str = rb_str_new ((char *) c.ids, c.len * sizeof(uint32_t));
+  fsFree (Ctx, c.ids);
+
+  return (str);
+}
+
+/*
+ * set.each { |id| ... } -> set, yielding the IDs in ascending order.
+ * The set's mutex is held while each batch is collected, not while it
+ * is yielded, so the block may use the set; a change shows from the
+ * next batch on.
+ */
+static VALUE
+setEach (VALUE self)
+{
+  Call     c;
+  VALUE    tmp;
+  uint32_t i;
+
+  RETURN_ENUMERATOR (self, 0, 0);
+
+  callInit (&c, doIds);
+  c.s      = getSet (self);
+  c.ids    = ALLOCV_N (uint32_t, tmp, EACH_CHUNK);
+  c.len    = EACH_CHUNK;
+  c.cursor = 1;
+
+  do
+  {
+    runOn (&c, "Filesets::Set#each", &self, 1);
+    for (i = 0; i < c.n; i++)
+      rb_yield (UINT2NUM (c.ids[i]));
+  } while (c.n > 0);
+
+  ALLOCV_END (tmp);
+
+  return (self);
+}
+
+/* -------------------------------------------------------------------- */
+
+static VALUE
+fsGetMax (VALUE mod)
+{
+  return (Ctx == NULL ? Qnil : UINT2NUM (fsContextMax (Ctx)));
+}
+
+static VALUE
+fsSetMax (VALUE mod, VALUE max)
+{
+  uint32_t    m = NUM2UINT (max);
+  FsContext * ctx;
+
+  if (m == 0 || m == (uint32_t) -1)
+    rb_raise (rb_eArgError, "max ID must be greater than zero");
+  if (Ctx != NULL && m == fsContextMax (Ctx))
+    return (max);
+  if (LiveSets > 0)
+    rb_raise (eError, "can't change Filesets.max while sets exist");
+
+  if (fsContextNew (&ctx, m, NULL) != FS_OK)
+    rb_raise (eError, "can't create a context");
+  fsContextFree (Ctx);
+  Ctx = ctx;
+
+  return (max);
+}
+
+static VALUE
+fsGetThreads (VALUE mod)
+{
+  return (UINT2NUM (Threads));
+}
+
+static VALUE
+fsSetThreads (VALUE mod, VALUE threads)
+{
+  uint32_t t = NUM2UINT (threads);
+
+  if (t < 1 || t > FS_MAX_THREADS)
+    rb_raise (rb_eArgError, "threads must be between 1 and %d", FS_MAX_THREADS);
+
+  Threads = t;
+  return (threads);
+}
+
+void
+Init_filesets_ext (void)
+{
+  mFilesets = rb_define_module ("Filesets");
+  eError    = rb_define_class_under (mFilesets, "Error", rb_eStandardError);
+  cSet      = rb_define_class_under (mFilesets, "Set", rb_cObject);
+
+  rb_define_module_function (mFilesets, "max",      fsGetMax,     0);
+  rb_define_module_function (mFilesets, "max=",     fsSetMax,     1);
+  rb_define_module_function (mFilesets, "threads",  fsGetThreads, 0);
+  rb_define_module_function (mFilesets, "threads=", fsSetThreads, 1);
+
+  rb_define_alloc_func (cSet, setAlloc);
+  rb_define_singleton_method (cSet, "load",        setLoad,       1);
+  rb_define_singleton_method (cSet, "from_packed", setFromPacked, 1);
+
+  rb_define_method (cSet, "initialize",      setInitialize,     0);
+  rb_define_method (cSet, "initialize_copy", setInitializeCopy, 1);
+  rb_define_method (cSet, "union!",          setUnionBang,     -1);
+  rb_define_method (cSet, "intersect!",      setIntersectBang, -1);
+  rb_define_method (cSet, "diff!",           setDiffBang,      -1);
+  rb_define_method (cSet, "invert!",         setInvertBang,     0);
+  rb_define_method (cSet, "count",           setCountIds,       0);
+  rb_define_method (cSet, "to_packed",       setToPacked,       0);
+  rb_define_method (cSet, "shuffle",         setShuffleIds,    -1);
+  rb_define_method (cSet, "each",            setEach,           0);
+}
@@ -0,0 +1,46 @@
+#
+# In-process set operations on integer IDs. The sets live in C, built
+# by the extension in ext/filesets_ext; see the README for the API.
+#
+#   Filesets.max = 20_000_000
+#   active = Filesets::Set.load("active.txt")
+#   active.intersect!(Filesets::Set.load("opted_in.txt"))
+#   ids = active.to_packed.unpack("L*")
+#
+require 'filesets/filesets_ext'
+
+module Filesets
+  class Set
+    include Enumerable
+
+    def self.from_ids(ids)
+      from_packed(ids.pack("L*"))
+    end
+
+    def union(*others)
+      dup.union!(*others)
+    end
+
+    def intersect(*others)
+      dup.intersect!(*others)
+    end
+
+    def diff(*others)
+      dup.diff!(*others)
+    end
+
+    def invert
+      dup.invert!
+    end
+
+    alias_method :|, :union
+    alias_method :&, :intersect
+    alias_method :-, :diff
+    alias_method :~, :invert
+    alias_method :size, :count
+
+    def to_a
+      to_packed.unpack("L*")
+    end
+  end
+end